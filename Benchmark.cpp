@@ -0,0 +1,225 @@
+/**
+ * @file Benchmark.cpp
+ *
+ * @brief TinyCBORWrapper micro benchmarks, build with "make bench"
+ *        bin/Benchmark-tinycbor runs them with TINYCBORWRAPPER_NATIVE=0
+ */
+
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+
+#include "TinyCborWrapper.hpp"
+#include "TinyCborStatic.hpp"
+
+
+//-----------------------------------------------------------------------------
+// Helpers
+//-----------------------------------------------------------------------------
+
+/* keeps results alive so the optimizer can't drop the measured work */
+static volatile size_t g_sink;
+
+
+//-----------------------------------------------------------------------------
+
+template <typename TFn>
+static void measure(const char* name, size_t iterations, size_t items, TFn fn)
+{
+    fn();
+    
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i)
+        fn();
+    auto stop = std::chrono::steady_clock::now();
+    
+    double ns = std::chrono::duration<double, std::nano>(stop - start).count();
+    std::cout << std::left << std::setw(44) << name
+            << std::right << std::setw(10) << std::fixed << std::setprecision(2)
+            << ns / iterations / 1000.0 << " us/op "
+            << std::setw(8) << ns / iterations / items << " ns/item" << std::endl;
+}
+
+
+//-----------------------------------------------------------------------------
+// Bulk numeric arrays
+//-----------------------------------------------------------------------------
+
+static void benchNumbers()
+{
+    using namespace CBOR;
+    
+    const size_t count = 50000;
+    const size_t iterations = 200;
+    
+    std::vector<float> samples(count);
+    std::vector<int32_t> counters(count);
+    for (size_t i = 0; i < count; ++i) {
+        samples[i] = 20.0f + (float)(i % 1000) * 0.01f;
+        counters[i] = (int32_t)(i * 37) - 100000;
+    }
+    
+    EncoderBuffer floats(count * 5 + 16);
+    EncoderBuffer ints(count * 5 + 16);
+    floats.encodeNumbers(samples.data(), samples.size());
+    ints.encodeNumbers(counters.data(), counters.size());
+    
+    measure("encode float[50k] per element", iterations, count, [&]() {
+        EncoderBuffer e(count * 5 + 16);
+        Encoder& inner = e << startArray(count);
+        for (float sample : samples)
+            inner.encode(CFloat(sample));
+        inner << end;
+        g_sink = e.size();
+    });
+    
+    measure("encode float[50k] encodeNumbers", iterations, count, [&]() {
+        EncoderBuffer e(count * 5 + 16);
+        e.encodeNumbers(samples.data(), samples.size());
+        g_sink = e.size();
+    });
+    
+    measure("encode int32[50k] per element", iterations, count, [&]() {
+        EncoderBuffer e(count * 5 + 16);
+        Encoder& inner = e << startArray(count);
+        for (int32_t counter : counters)
+            inner.encode(CInt(counter));
+        inner << end;
+        g_sink = e.size();
+    });
+    
+    measure("encode int32[50k] encodeNumbers", iterations, count, [&]() {
+        EncoderBuffer e(count * 5 + 16);
+        e.encodeNumbers(counters.data(), counters.size());
+        g_sink = e.size();
+    });
+    
+    measure("decode float[50k] per element", iterations, count, [&]() {
+        std::vector<float> values;
+        DecoderBuffer d(floats.getBuffer(), floats.size());
+        Decoder& inner = enter(d);
+        values.reserve(count);
+        while (!inner.atEnd())
+            values.push_back(inner.decodeFloat());
+        leave(inner);
+        g_sink = values.size();
+    });
+    
+    measure("decode float[50k] decodeNumbers", iterations, count, [&]() {
+        std::vector<float> values;
+        DecoderBuffer d(floats.getBuffer(), floats.size());
+        d.decodeNumbers(values);
+        g_sink = values.size();
+    });
+    
+    measure("decode int32[50k] per element", iterations, count, [&]() {
+        std::vector<int32_t> values;
+        DecoderBuffer d(ints.getBuffer(), ints.size());
+        Decoder& inner = enter(d);
+        values.reserve(count);
+        while (!inner.atEnd())
+            values.push_back((int32_t)inner.decodeInt());
+        leave(inner);
+        g_sink = values.size();
+    });
+    
+    measure("decode int32[50k] decodeNumbers", iterations, count, [&]() {
+        std::vector<int32_t> values;
+        DecoderBuffer d(ints.getBuffer(), ints.size());
+        d.decodeNumbers(values);
+        g_sink = values.size();
+    });
+}
+
+
+//-----------------------------------------------------------------------------
+// Virtual vs. template encoder
+//-----------------------------------------------------------------------------
+
+static void benchStatic()
+{
+    using namespace CBOR;
+    
+    const size_t iterations = 1000000;
+    const uint32_t id = 4711;
+    const int64_t timestamp = 1700000000123;
+    const float temperature = 21.5f;
+    const double latitude = 48.137154;
+    const std::string name = "sensor-12";
+    
+    uint8_t buffer[64];
+    
+    /* both sides write into the stack buffer and don't allocate, the inner 
+     * containers of Encoder and Decoder come from a reused Arena */
+    Arena arena;
+    
+    measure("encode struct Encoder", iterations, 1, [&]() {
+        EncoderSpan e(buffer, sizeof(buffer));
+        e.setArena(&arena);
+        Encoder& inner = createArray(e, 5);
+        inner << CUint(id) << CInt(timestamp) << CFloat(temperature)
+                << CDouble(latitude) << CString(name);
+        end(inner);
+        arena.reset();
+        g_sink = e.size();
+    });
+    
+    measure("encode struct BasicEncoder<SpanSink>", iterations, 1, [&]() {
+        SpanSink sink(buffer, sizeof(buffer));
+        BasicEncoder<SpanSink> e(sink);
+        e.beginArray(5) << id << timestamp << temperature << latitude << name;
+        g_sink = sink.size();
+    });
+    
+    EncoderBuffer encoded(sizeof(buffer));
+    encoded << startArray(5) << CUint(id) << CInt(timestamp) << CFloat(temperature)
+            << CDouble(latitude) << CString(name) << end;
+    
+    measure("decode struct Decoder", iterations, 1, [&]() {
+        DecoderBuffer d(encoded.getBuffer(), encoded.size());
+        d.setArena(&arena);
+        Decoder& inner = enter(d);
+        size_t sum = inner.decodeUint();
+        sum += inner.decodeInt();
+        sum += inner.decodeFloat();
+        sum += inner.decodeDouble();
+        size_t len;
+        inner.decodeStringView(len);
+        leave(inner);
+        arena.reset();
+        g_sink = sum + len;
+    });
+    
+    measure("decode struct BasicDecoder", iterations, 1, [&]() {
+        BasicDecoder<> d(encoded.getBuffer(), encoded.size());
+        d.enterArray();
+        size_t sum = d.decodeUint();
+        sum += d.decodeInt();
+        sum += d.decodeFloat();
+        sum += d.decodeDouble();
+        size_t len;
+        d.decodeString(len);
+        g_sink = sum + len;
+    });
+}
+
+
+//-----------------------------------------------------------------------------
+// Main
+//-----------------------------------------------------------------------------
+
+int main() {
+    
+    /* numbers only compare with the same tinycbor release behind them */
+    std::cout << "tinycbor " << TINYCBOR_VERSION_MAJOR << "." << TINYCBOR_VERSION_MINOR 
+            << "." << TINYCBOR_VERSION_PATCH << ", primitives: " 
+            << (TINYCBORWRAPPER_NATIVE ? "inline" : "tinycbor") << std::endl;
+    
+    benchNumbers();
+    benchStatic();
+    
+    return 0;
+}
+
+
+//-----------------------------------------------------------------------------
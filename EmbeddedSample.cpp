@@ -0,0 +1,119 @@
+/**
+ * @file EmbeddedSample.cpp
+ *
+ * @brief Struct encoder and decoder built with the embedded profile of
+ *        TinyCborStatic.hpp, "make size" reports their code size
+ */
+
+#include "TinyCborStatic.hpp"
+
+
+//-----------------------------------------------------------------------------
+// Struct to serialize and deserialize
+//-----------------------------------------------------------------------------
+
+struct Reading {
+    uint32_t id;
+    int64_t timestamp;
+    float temperature;
+    double latitude;
+    char name[16];
+};
+
+
+//-----------------------------------------------------------------------------
+// Serialization
+//-----------------------------------------------------------------------------
+
+/**
+ * Encode value as map into pBuffer, returns the size or 0 if it doesn't fit
+ */
+size_t encodeReading(const Reading& value, uint8_t* pBuffer, size_t buffer_size)
+{
+    using namespace CBOR;
+
+    SpanSink sink(pBuffer, buffer_size);
+    BasicEncoder<SpanSink> encoder(sink);
+
+    encoder.beginMap(5)
+            << "id" << value.id
+            << "timestamp" << value.timestamp
+            << "temperature" << value.temperature
+            << "latitude" << value.latitude
+            << "name" << value.name;
+
+    return encoder.error() == CborNoError ? sink.size() : 0;
+}
+
+
+//-----------------------------------------------------------------------------
+
+static bool isKey(const char* key, size_t len, const char* name)
+{
+    return strlen(name) == len && memcmp(key, name, len) == 0;
+}
+
+
+//-----------------------------------------------------------------------------
+
+/**
+ * Decode a map written by encodeReading(), unknown keys are skipped
+ */
+bool decodeReading(Reading& value, const uint8_t* pBuffer, size_t buffer_size)
+{
+    using namespace CBOR;
+
+    BasicDecoder<> decoder(pBuffer, buffer_size);
+    size_t count = decoder.enterMap();
+
+    for (size_t i = 0; i < count && decoder.error() == CborNoError; ++i) {
+        size_t len;
+        const char* key = decoder.decodeString(len);
+
+        if (!key)
+            break;
+        else if (isKey(key, len, "id"))
+            value.id = (uint32_t)decoder.decodeUint();
+        else if (isKey(key, len, "timestamp"))
+            value.timestamp = decoder.decodeInt();
+        else if (isKey(key, len, "temperature"))
+            value.temperature = decoder.decodeFloat();
+        else if (isKey(key, len, "latitude"))
+            value.latitude = decoder.decodeDouble();
+        else if (isKey(key, len, "name")) {
+            const char* name = decoder.decodeString(len);
+            if (!name)
+                break;
+            if (len >= sizeof(value.name))
+                len = sizeof(value.name) - 1;
+            memcpy(value.name, name, len);
+            value.name[len] = 0;
+        } else
+            decoder.skip();
+    }
+
+    return decoder.error() == CborNoError;
+}
+
+
+//-----------------------------------------------------------------------------
+// Main
+//-----------------------------------------------------------------------------
+
+int main() {
+
+    Reading reading = { 4711, 1700000000123ll, 21.5f, 48.137154, "sensor-12" };
+    uint8_t buffer[96];
+
+    size_t size = encodeReading(reading, buffer, sizeof(buffer));
+
+    Reading decoded = Reading();
+    if (!size || !decodeReading(decoded, buffer, size))
+        return 1;
+
+    return decoded.id == reading.id && decoded.timestamp == reading.timestamp
+            && decoded.latitude == reading.latitude ? 0 : 1;
+}
+
+
+//-----------------------------------------------------------------------------
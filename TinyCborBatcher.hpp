@@ -0,0 +1,218 @@
+/**
+ * @file TinyCborBatcher.hpp
+ *
+ * @brief Records packed into frames of a fixed maximum size, each frame is
+ *        a definite length array of whole records. Frames are closed when
+ *        full, at a record count or when a deadline expires.
+ */
+
+#ifndef TINYCBORBATCHER_HPP_
+#define TINYCBORBATCHER_HPP_
+
+#include "TinyCborWrapper.hpp"
+#include <chrono>
+
+namespace CBOR {
+
+
+//-----------------------------------------------------------------------------
+// Frame Batcher
+//-----------------------------------------------------------------------------
+
+/**
+ * Collects records until the next one would exceed the MTU, then hands the
+ * frame to the sink and starts a new one with that record:
+ *
+ *   FrameBatcher batcher(1024, [&](const uint8_t* frame, size_t size) {
+ *       radio.send(frame, size);
+ *   });
+ *
+ *   for (const Reading& reading : readings)
+ *       batcher.add(reading);
+ *   batcher.flush();
+ *
+ * The records are encoded behind room for the largest array header, which
+ * is written in front of them on flush(). A record that is rejected is
+ * rolled back, so the frame always holds whole records.
+ *
+ * Throughput versus latency is tuned with setMaxBytes(), setMaxRecords()
+ * and setMaxDelay(). The delay counts from the first record of a frame and
+ * is checked by add() and poll(), call poll() from the event loop when
+ * records may stop arriving, deadline() tells when.
+ *
+ * Nothing is allocated once the first record is added: the frame has a
+ * fixed buffer and containers of the records live in an Arena that is reused.
+ */
+class FrameBatcher
+{
+
+public:
+
+    typedef std::function<void(const uint8_t* frame, size_t size)> tFrameSink;
+    typedef std::chrono::steady_clock Clock;
+
+    FrameBatcher(size_t mtu, tFrameSink sink)
+        : m_storage(std::max<size_t>(mtu, 1) + HeaderRoom - 1),
+          m_records(m_storage.data() + HeaderRoom, m_storage.size() - HeaderRoom),
+          m_sink(sink)
+    {
+        init(m_storage.data(), m_storage.size());
+    }
+
+    /* frames in caller memory, e.g. a DMA buffer, of up to buffer_size - 8 bytes */
+    FrameBatcher(uint8_t* pBuffer, size_t buffer_size, tFrameSink sink)
+        : m_records(pBuffer + HeaderRoom, buffer_size > HeaderRoom ? buffer_size - HeaderRoom : 0),
+          m_sink(sink)
+    {
+        init(pBuffer, buffer_size > HeaderRoom ? buffer_size : HeaderRoom);
+    }
+
+    /* close frames at bytes instead of the MTU */
+    void setMaxBytes(size_t bytes) { m_maxBytes = std::min(bytes, m_mtu); }
+
+    size_t getMaxBytes() const { return m_maxBytes; }
+
+    /* close frames at count records, SIZE_MAX for no limit */
+    void setMaxRecords(size_t count) { m_maxRecords = std::max<size_t>(count, 1); }
+
+    size_t getMaxRecords() const { return m_maxRecords; }
+
+    /* close frames delay after their first record, Clock::duration::max() for no limit */
+    void setMaxDelay(Clock::duration delay) { m_maxDelay = delay; }
+
+    Clock::duration getMaxDelay() const { return m_maxDelay; }
+
+    /**
+     * Append record to the current frame, or to a new one if it is full.
+     * Throws EncoderException(CborErrorOutOfMemory) if the record doesn't
+     * fit into an empty frame.
+     */
+    template <typename T>
+    void add(const T& record)
+    {
+        if (!append(record)) {
+            if (!m_count)
+                throw EncoderException(CborErrorOutOfMemory);
+
+            flush();
+            if (!append(record))
+                throw EncoderException(CborErrorOutOfMemory);
+        }
+
+        bool late = false;
+        if (m_maxDelay != Clock::duration::max()) {
+            Clock::time_point now = Clock::now();
+            if (m_count == 1)
+                m_deadline = now + m_maxDelay;
+            late = now >= m_deadline;
+        }
+
+        /* also close the frame if not even a one byte record fits anymore */
+        if (late || m_count >= m_maxRecords
+                || headSize(m_count + 1) + m_records.size() >= m_maxBytes)
+            flush();
+    }
+
+    /* flush the frame if its deadline expired, true if it was passed on */
+    bool poll(Clock::time_point now = Clock::now())
+    {
+        if (!m_count || now < m_deadline)
+            return false;
+
+        flush();
+        return true;
+    }
+
+    /* when poll() has to be called next, Clock::time_point::max() if never */
+    Clock::time_point deadline() const { return m_deadline; }
+
+    /* pass the current frame to the sink if it holds any records */
+    void flush()
+    {
+        if (!m_count)
+            return;
+
+        uint8_t* pRecords = m_pFrame + HeaderRoom;
+        uint8_t* pFrame = pRecords - headSize(m_count);
+        writeHead(pFrame, CborArrayType, m_count);
+
+        size_t size = (pRecords - pFrame) + m_records.size();
+        m_records.reset();
+        m_count = 0;
+        m_deadline = Clock::time_point::max();
+
+        m_sink(pFrame, size);
+    }
+
+    /* records in the current frame */
+    size_t count() const { return m_count; }
+
+    /* encoded size of the current frame including the array header */
+    size_t size() { return headSize(m_count) + m_records.size(); }
+
+    size_t mtu() const { return m_mtu; }
+
+    /* for the encoder settings, records are written with add() */
+    Encoder& getEncoder() { return m_records; }
+
+private:
+
+    static const size_t HeaderRoom = 9;
+
+    void init(uint8_t* pFrame, size_t frame_size)
+    {
+        m_pFrame = pFrame;
+        m_mtu = frame_size - HeaderRoom + 1;
+        m_maxBytes = m_mtu;
+        m_maxRecords = SIZE_MAX;
+        m_maxDelay = Clock::duration::max();
+        m_deadline = Clock::time_point::max();
+        m_count = 0;
+        m_records.setArena(&m_arena);
+    }
+
+    /* encode record behind the others, false if the frame can't take it */
+    template <typename T>
+    bool append(const T& record)
+    {
+        Encoder::Checkpoint cp = m_records.mark();
+
+        try {
+            m_records << record;
+        } catch (...) {
+            m_records.rollback(cp);
+            m_arena.reset();
+            throw;
+        }
+        /* the containers of the record are closed */
+        m_arena.reset();
+
+        if (!m_records.overflowed() && headSize(m_count + 1) + m_records.size() <= m_maxBytes) {
+            ++m_count;
+            return true;
+        }
+
+        m_records.rollback(cp);
+        return false;
+    }
+
+    std::vector<uint8_t> m_storage;
+    Arena m_arena;
+    EncoderSpan m_records;
+    tFrameSink m_sink;
+    uint8_t* m_pFrame;
+    size_t m_mtu;
+    size_t m_maxBytes;
+    size_t m_maxRecords;
+    Clock::duration m_maxDelay;
+    Clock::time_point m_deadline;
+    size_t m_count;
+};
+
+
+//-----------------------------------------------------------------------------
+
+
+}
+
+#endif /* TINYCBORBATCHER_HPP_ */
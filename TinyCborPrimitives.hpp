@@ -0,0 +1,395 @@
+/**
+ * @file TinyCborPrimitives.hpp
+ *
+ * @brief Byte order, half float and item head helpers shared by the
+ *        wrapper and TinyCborStatic.hpp, and items encoded at compile time.
+ *        No exceptions or heap.
+ */
+
+#ifndef TINYCBORPRIMITIVES_HPP_
+#define TINYCBORPRIMITIVES_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace CBOR {
+
+
+//-----------------------------------------------------------------------------
+// Helpers
+//-----------------------------------------------------------------------------
+
+inline float halfToFloat(uint16_t half)
+{
+    uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+    uint32_t exp = (half >> 10) & 0x1f;
+    uint32_t mant = half & 0x3ff;
+    uint32_t bits;
+    
+    if (exp == 0x1f) {
+        bits = sign | 0x7f800000 | (mant << 13);
+    } else if (exp != 0) {
+        bits = sign | ((exp + 112) << 23) | (mant << 13);
+    } else if (mant == 0) {
+        bits = sign;
+    } else {
+        /* subnormal half, normalize */
+        exp = 113;
+        while (!(mant & 0x400)) {
+            mant <<= 1;
+            --exp;
+        }
+        bits = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+    }
+    
+    float ret;
+    memcpy(&ret, &bits, sizeof(ret));
+    return ret;
+}
+
+
+//-----------------------------------------------------------------------------
+
+/* round to nearest even, overflows to infinity */
+inline uint16_t floatToHalf(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    
+    uint16_t sign = (bits >> 16) & 0x8000;
+    uint32_t mant = bits & 0x7fffff;
+    int32_t exp = (int32_t)((bits >> 23) & 0xff) - 127 + 15;
+    
+    if (exp == 0xff - 127 + 15)
+        return sign | 0x7c00 | (mant ? 0x200 | (mant >> 13) : 0);
+    if (exp >= 0x1f)
+        return sign | 0x7c00;
+    
+    uint32_t shift = 13;
+    uint32_t half = ((uint32_t)exp << 10) | (mant >> 13);
+    
+    if (exp <= 0) {
+        if (exp < -10)
+            return sign;
+        /* subnormal half, shift in the implicit leading one */
+        mant |= 0x800000;
+        shift = 14 - exp;
+        half = mant >> shift;
+    }
+    
+    uint32_t rest = mant & ((1u << shift) - 1);
+    uint32_t halfway = 1u << (shift - 1);
+    if (rest > halfway || (rest == halfway && (half & 1)))
+        ++half;
+    
+    return sign | (uint16_t)half;
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline uint16_t byteSwap(uint16_t v)
+{
+#if defined(__GNUC__)
+    return __builtin_bswap16(v);
+#else
+    return (uint16_t)((v << 8) | (v >> 8));
+#endif
+}
+
+inline uint32_t byteSwap(uint32_t v)
+{
+#if defined(__GNUC__)
+    return __builtin_bswap32(v);
+#else
+    return (v << 24) | ((v & 0xff00) << 8) | ((v >> 8) & 0xff00) | (v >> 24);
+#endif
+}
+
+inline uint64_t byteSwap(uint64_t v)
+{
+#if defined(__GNUC__)
+    return __builtin_bswap64(v);
+#else
+    return ((uint64_t)byteSwap((uint32_t)v) << 32) | byteSwap((uint32_t)(v >> 32));
+#endif
+}
+
+
+//-----------------------------------------------------------------------------
+
+/* CBOR is big endian, these read and write unaligned big endian numbers */
+
+template <typename T>
+inline void storeBigEndian(uint8_t* p, T v)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    memcpy(p, &v, sizeof(v));
+#else
+    v = byteSwap(v);
+    memcpy(p, &v, sizeof(v));
+#endif
+}
+
+template <typename T>
+inline T loadBigEndian(const uint8_t* p)
+{
+    T v;
+    memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return v;
+#else
+    return byteSwap(v);
+#endif
+}
+
+
+//-----------------------------------------------------------------------------
+
+/**
+ * Write the initial byte and argument of an item in its shortest form, 
+ * needs up to 9 bytes.
+ */
+inline uint8_t* writeHead(uint8_t* p, uint8_t major, uint64_t value)
+{
+    if (value < 24) {
+        p[0] = major | (uint8_t)value;
+        return p + 1;
+    }
+    if (value <= 0xff) {
+        p[0] = major | 24;
+        p[1] = (uint8_t)value;
+        return p + 2;
+    }
+    if (value <= 0xffff) {
+        p[0] = major | 25;
+        storeBigEndian(p + 1, (uint16_t)value);
+        return p + 3;
+    }
+    if (value <= 0xffffffff) {
+        p[0] = major | 26;
+        storeBigEndian(p + 1, (uint32_t)value);
+        return p + 5;
+    }
+    
+    p[0] = major | 27;
+    storeBigEndian(p + 1, value);
+    return p + 9;
+}
+
+
+//-----------------------------------------------------------------------------
+
+/* bytes writeHead() needs for value */
+constexpr size_t headSize(uint64_t value)
+{
+    return value < 24 ? 1 : value <= 0xff ? 2 : value <= 0xffff ? 3 
+            : value <= 0xffffffff ? 5 : 9;
+}
+
+
+//-----------------------------------------------------------------------------
+
+/**
+ * Read the argument of the item at p, nullptr if it is truncated or uses an
+ * indefinite length.
+ */
+inline const uint8_t* readHead(const uint8_t* p, const uint8_t* pEnd, uint64_t& value)
+{
+    uint8_t info = p[0] & 0x1f;
+    
+    if (info < 24) {
+        value = info;
+        return p + 1;
+    }
+    if (info > 27)
+        return nullptr;
+    
+    size_t size = (size_t)1 << (info - 24);
+    if ((size_t)(pEnd - p) <= size)
+        return nullptr;
+    
+    switch (size) {
+    case 1: value = p[1]; break;
+    case 2: value = loadBigEndian<uint16_t>(p + 1); break;
+    case 4: value = loadBigEndian<uint32_t>(p + 1); break;
+    default: value = loadBigEndian<uint64_t>(p + 1); break;
+    }
+    
+    return p + 1 + size;
+}
+
+
+//-----------------------------------------------------------------------------
+// Compile Time Encoding
+//-----------------------------------------------------------------------------
+
+/* already encoded items, written as they are */
+struct CEncoded
+{
+    const uint8_t* data;
+    size_t size;
+    
+    /* top level items in data, counted for the enclosing container */
+    size_t items;
+};
+
+
+//-----------------------------------------------------------------------------
+
+/**
+ * One item encoded at compile time. Build it with constUint(), constText(),
+ * constArray() etc. into a constexpr variable at namespace scope and write
+ * it like any other value, sending it only copies data:
+ *
+ *   constexpr auto hello = constMap(constText("version"), constUint<2>());
+ *   encoder << hello;
+ */
+template <size_t N>
+struct ConstItem
+{
+    uint8_t data[N];
+    
+    constexpr size_t size() const { return N; }
+    
+    operator CEncoded() const { return CEncoded{data, N, 1}; }
+};
+
+
+//-----------------------------------------------------------------------------
+
+template <size_t... I> struct Indices { };
+
+template <typename A, typename B> struct JoinIndices;
+
+template <size_t... I, size_t... J>
+struct JoinIndices<Indices<I...>, Indices<J...> >
+{
+    typedef Indices<I..., (sizeof...(I) + J)...> type;
+};
+
+/* 0 .. N - 1, built in halves to keep the template recursion shallow */
+template <size_t N>
+struct MakeIndices
+{
+    typedef typename JoinIndices<typename MakeIndices<N / 2>::type, 
+            typename MakeIndices<N - N / 2>::type>::type type;
+};
+
+template <> struct MakeIndices<0> { typedef Indices<> type; };
+template <> struct MakeIndices<1> { typedef Indices<0> type; };
+
+
+//-----------------------------------------------------------------------------
+
+/* byte i of the head writeHead() writes */
+constexpr uint8_t headByte(uint8_t major, uint64_t value, size_t i)
+{
+    return i == 0 
+            ? (uint8_t)(major | (value < 24 ? value : value <= 0xff ? 24 
+                    : value <= 0xffff ? 25 : value <= 0xffffffff ? 26 : 27))
+            : (uint8_t)(value >> (8 * (headSize(value) - 1 - i)));
+}
+
+template <size_t... I>
+constexpr ConstItem<sizeof...(I)> constHead(uint8_t major, uint64_t value, Indices<I...>)
+{
+    return ConstItem<sizeof...(I)>{{ headByte(major, value, I)... }};
+}
+
+template <size_t H, size_t L, typename T, size_t N, size_t... I>
+constexpr ConstItem<sizeof...(I)> constString(uint8_t major, const T (&str)[N], Indices<I...>)
+{
+    return ConstItem<sizeof...(I)>{{ 
+            (uint8_t)(I < H ? headByte(major, L, I) : (uint8_t)str[I - H])... }};
+}
+
+constexpr size_t sizeSum() { return 0; }
+
+template <typename... T>
+constexpr size_t sizeSum(size_t size, T... sizes) { return size + sizeSum(sizes...); }
+
+template <size_t A, size_t B, size_t... I>
+constexpr ConstItem<A + B> join(const ConstItem<A>& a, const ConstItem<B>& b, Indices<I...>)
+{
+    return ConstItem<A + B>{{ (I < A ? a.data[I] : b.data[I - A])... }};
+}
+
+template <size_t A>
+constexpr ConstItem<A> concat(const ConstItem<A>& a) { return a; }
+
+template <size_t A, size_t B, size_t... N>
+constexpr ConstItem<A + B + sizeSum(N...)> concat(
+        const ConstItem<A>& a, const ConstItem<B>& b, const ConstItem<N>&... rest)
+{
+    return join(a, concat(b, rest...), typename MakeIndices<A + B + sizeSum(N...)>::type());
+}
+
+
+//-----------------------------------------------------------------------------
+
+template <uint64_t V>
+constexpr ConstItem<headSize(V)> constUint()
+{
+    return constHead(0x00, V, typename MakeIndices<headSize(V)>::type());
+}
+
+template <int64_t V>
+constexpr ConstItem<headSize(V < 0 ? ~(uint64_t)V : (uint64_t)V)> constInt()
+{
+    return constHead(V < 0 ? 0x20 : 0x00, V < 0 ? ~(uint64_t)V : (uint64_t)V, 
+            typename MakeIndices<headSize(V < 0 ? ~(uint64_t)V : (uint64_t)V)>::type());
+}
+
+constexpr ConstItem<1> constBool(bool value) { return ConstItem<1>{{ (uint8_t)(value ? 0xf5 : 0xf4) }}; }
+
+constexpr ConstItem<1> constNull() { return ConstItem<1>{{ 0xf6 }}; }
+
+constexpr ConstItem<1> constUndefined() { return ConstItem<1>{{ 0xf7 }}; }
+
+/* text string from a literal, without the terminating zero */
+template <size_t N>
+constexpr ConstItem<headSize(N - 1) + N - 1> constText(const char (&str)[N])
+{
+    return constString<headSize(N - 1), N - 1>(
+            0x60, str, typename MakeIndices<headSize(N - 1) + N - 1>::type());
+}
+
+template <size_t N>
+constexpr ConstItem<headSize(N) + N> constBytes(const uint8_t (&bytes)[N])
+{
+    return constString<headSize(N), N>(
+            0x40, bytes, typename MakeIndices<headSize(N) + N>::type());
+}
+
+template <size_t... N>
+constexpr ConstItem<headSize(sizeof...(N)) + sizeSum(N...)> constArray(const ConstItem<N>&... items)
+{
+    return concat(constHead(0x80, sizeof...(N), 
+            typename MakeIndices<headSize(sizeof...(N))>::type()), items...);
+}
+
+/* alternating keys and values */
+template <size_t... N>
+constexpr ConstItem<headSize(sizeof...(N) / 2) + sizeSum(N...)> constMap(const ConstItem<N>&... items)
+{
+    static_assert(sizeof...(N) % 2 == 0, "a value is needed for every key");
+    
+    return concat(constHead(0xa0, sizeof...(N) / 2, 
+            typename MakeIndices<headSize(sizeof...(N) / 2)>::type()), items...);
+}
+
+template <uint64_t Tag, size_t N>
+constexpr ConstItem<headSize(Tag) + N> constTag(const ConstItem<N>& item)
+{
+    return concat(constHead(0xc0, Tag, typename MakeIndices<headSize(Tag)>::type()), item);
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+}
+
+#endif /* TINYCBORPRIMITIVES_HPP_ */
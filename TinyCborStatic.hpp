@@ -0,0 +1,703 @@
+/**
+ * @file TinyCborStatic.hpp
+ *
+ * @brief Template encoder and decoder without virtual functions, RTTI or
+ *        calls into tinycbor. Output buffer, growth and error handling are
+ *        template parameters, so encoding a struct inlines to plain stores.
+ *
+ * Embedded profile, selected by defining TINYCBOR_EMBEDDED or compiling with
+ * -fno-exceptions: only cbor.h and TinyCborPrimitives.hpp are included, there
+ * are no exceptions, heap allocations, RTTI or static data, and errors are
+ * recorded (RecordErrors). Worst case RAM, with 4 byte pointers and size_t:
+ * - SpanSink: 16 bytes, ArraySink<N>: N + 16 bytes
+ * - BasicEncoder<Sink, RecordErrors>: 8 bytes
+ * - BasicDecoder<RecordErrors>: 16 bytes
+ * - stack: a few words per call, skip() adds 4 * TINYCBOR_MAX_DEPTH bytes,
+ *   nothing is recursive
+ */
+
+#ifndef TINYCBORSTATIC_HPP_
+#define TINYCBORSTATIC_HPP_
+
+#if !defined(TINYCBOR_EMBEDDED) && !defined(__cpp_exceptions) && !defined(__EXCEPTIONS)
+#define TINYCBOR_EMBEDDED
+#endif
+
+/* containers skip() can be nested in */
+#ifndef TINYCBOR_MAX_DEPTH
+#define TINYCBOR_MAX_DEPTH 8
+#endif
+
+#if defined(TINYCBOR_EMBEDDED)
+#include <cbor.h>
+#include "TinyCborPrimitives.hpp"
+#else
+#include "TinyCborWrapper.hpp"
+#endif
+
+namespace CBOR {
+
+
+//-----------------------------------------------------------------------------
+// Error Policies
+//-----------------------------------------------------------------------------
+
+/* remembers the first error, check error() when done */
+struct RecordErrors
+{
+    RecordErrors() : m_error(CborNoError) { }
+
+    void encoderError(CborError err) { decoderError(err); }
+
+    void decoderError(CborError err)
+    {
+        if (m_error == CborNoError)
+            m_error = err;
+    }
+
+    CborError error() const { return m_error; }
+
+private:
+    CborError m_error;
+};
+
+
+//-----------------------------------------------------------------------------
+
+#if !defined(TINYCBOR_EMBEDDED)
+
+/* EncoderException / DecoderException on the first error */
+struct ThrowErrors
+{
+    void encoderError(CborError err) { throw EncoderException(err); }
+
+    void decoderError(CborError err) { throw DecoderException(err); }
+
+    CborError error() const { return CborNoError; }
+};
+
+typedef ThrowErrors DefaultErrors;
+
+#else
+
+typedef RecordErrors DefaultErrors;
+
+#endif
+
+
+//-----------------------------------------------------------------------------
+// Sinks
+//-----------------------------------------------------------------------------
+
+/**
+ * Caller provided memory. reserve() returns nullptr if len bytes don't fit,
+ * the encoder then only counts the missing bytes, see needed().
+ */
+class SpanSink
+{
+
+public:
+
+    SpanSink(uint8_t* pBuffer, size_t buffer_size)
+        : m_pBegin(pBuffer), m_p(pBuffer), m_pEnd(pBuffer + buffer_size), m_needed(0) { }
+
+    uint8_t* reserve(size_t len)
+    {
+        return !m_needed && (size_t)(m_pEnd - m_p) >= len ? m_p : nullptr;
+    }
+
+    void commit(uint8_t* p) { m_p = p; }
+
+    void overflow(size_t len) { m_needed += len; }
+
+    void reset()
+    {
+        m_p = m_pBegin;
+        m_needed = 0;
+    }
+
+    uint8_t* data() { return m_pBegin; }
+
+    size_t size() const { return m_p - m_pBegin; }
+
+    /* buffer size + needed() fits the whole message */
+    size_t needed() const { return m_needed ? m_needed - (m_pEnd - m_p) : 0; }
+
+private:
+
+    uint8_t* m_pBegin;
+    uint8_t* m_p;
+    uint8_t* m_pEnd;
+    size_t m_needed;
+};
+
+
+//-----------------------------------------------------------------------------
+
+/* N bytes of inline storage, e.g. on the stack */
+template <size_t N>
+class ArraySink : public SpanSink
+{
+
+public:
+
+    ArraySink() : SpanSink(m_buffer, N) { }
+
+    ArraySink(const ArraySink&) = delete;
+    ArraySink& operator=(const ArraySink&) = delete;
+
+private:
+
+    uint8_t m_buffer[N];
+};
+
+
+//-----------------------------------------------------------------------------
+
+#if !defined(TINYCBOR_EMBEDDED)
+
+/* growth policies of VectorSink, the new capacity for at least needed bytes */
+struct GrowDouble
+{
+    static size_t capacity(size_t current, size_t needed)
+    {
+        return std::max(2 * current, needed);
+    }
+};
+
+struct GrowExact
+{
+    static size_t capacity(size_t, size_t needed) { return needed; }
+};
+
+
+//-----------------------------------------------------------------------------
+
+template <typename Growth = GrowDouble>
+class VectorSink
+{
+
+public:
+
+    VectorSink(size_t capacity = 256) : m_size(0) { m_data.resize(capacity); }
+
+    uint8_t* reserve(size_t len)
+    {
+        if (m_data.size() - m_size < len)
+            m_data.resize(Growth::capacity(m_data.size(), m_size + len));
+
+        return m_data.data() + m_size;
+    }
+
+    void commit(uint8_t* p) { m_size = p - m_data.data(); }
+
+    void overflow(size_t) { }
+
+    void reset() { m_size = 0; }
+
+    uint8_t* data() { return m_data.data(); }
+
+    size_t size() const { return m_size; }
+
+    size_t needed() const { return 0; }
+
+private:
+
+    std::vector<uint8_t> m_data;
+    size_t m_size;
+};
+
+#endif
+
+
+//-----------------------------------------------------------------------------
+// Basic Encoder
+//-----------------------------------------------------------------------------
+
+/**
+ * Encoder writing directly into a Sink. Containers are plain headers, there
+ * are no objects per nesting level: beginArray(n) is followed by n items,
+ * beginArray() by items and endContainer().
+ */
+template <typename Sink, typename Errors = DefaultErrors>
+class BasicEncoder : public Errors
+{
+
+public:
+
+    BasicEncoder(Sink& sink) : m_rSink(sink) { }
+
+    /* built-in integer types, the fixed width typedefs map to different 
+     * ones per target, e.g. int32_t is long on arm-none-eabi */
+    BasicEncoder& encode(unsigned long long value) { return encodeUnsigned(value); }
+    BasicEncoder& encode(unsigned long value) { return encodeUnsigned(value); }
+    BasicEncoder& encode(unsigned int value) { return encodeUnsigned(value); }
+    BasicEncoder& encode(unsigned short value) { return encodeUnsigned(value); }
+    BasicEncoder& encode(unsigned char value) { return encodeUnsigned(value); }
+    BasicEncoder& encode(long long value) { return encodeSigned(value); }
+    BasicEncoder& encode(long value) { return encodeSigned(value); }
+    BasicEncoder& encode(int value) { return encodeSigned(value); }
+    BasicEncoder& encode(short value) { return encodeSigned(value); }
+    BasicEncoder& encode(signed char value) { return encodeSigned(value); }
+
+    BasicEncoder& encode(bool value) { return byte(CborSimpleType | (value ? 21 : 20)); }
+
+    BasicEncoder& encode(float value)
+    {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        return fixed(CborFloatType, bits);
+    }
+
+    BasicEncoder& encode(double value)
+    {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        return fixed(CborDoubleType, bits);
+    }
+
+    BasicEncoder& encode(const char* str) { return encodeString(str, strlen(str)); }
+
+#if !defined(TINYCBOR_EMBEDDED)
+    BasicEncoder& encode(const std::string& str) { return encodeString(str.data(), str.size()); }
+#endif
+
+    BasicEncoder& encodeString(const char* str, size_t len)
+    {
+        return string(CborTextStringType, str, len);
+    }
+
+    BasicEncoder& encodeBytes(const uint8_t* bytes, size_t len)
+    {
+        return string(CborByteStringType, bytes, len);
+    }
+
+    /* already encoded items, e.g. a ConstItem */
+    BasicEncoder& encode(const CEncoded& value) { return raw(value.data, value.size); }
+
+    BasicEncoder& encodeNull() { return byte(CborSimpleType | 22); }
+
+    BasicEncoder& encodeTag(CborTag tag) { return head(CborTagType, tag); }
+
+    BasicEncoder& beginArray(size_t size) { return head(CborArrayType, size); }
+
+    BasicEncoder& beginArray() { return byte(CborArrayType | 31); }
+
+    BasicEncoder& beginMap(size_t size) { return head(CborMapType, size); }
+
+    BasicEncoder& beginMap() { return byte(CborMapType | 31); }
+
+    /* closes a container opened without size */
+    BasicEncoder& endContainer() { return byte(0xff); }
+
+    Sink& getSink() { return m_rSink; }
+
+private:
+
+    BasicEncoder& encodeUnsigned(uint64_t value) { return head(CborIntegerType, value); }
+
+    BasicEncoder& encodeSigned(int64_t value)
+    {
+        uint64_t sign = (uint64_t)(value >> 63);
+        return head((uint8_t)(sign & 0x20), (uint64_t)value ^ sign);
+    }
+
+    BasicEncoder& head(uint8_t major, uint64_t value)
+    {
+        size_t len = headSize(value);
+        uint8_t* p = m_rSink.reserve(len);
+        if (p)
+            m_rSink.commit(writeHead(p, major, value));
+        else
+            fail(len);
+
+        return *this;
+    }
+
+    BasicEncoder& byte(uint8_t value)
+    {
+        uint8_t* p = m_rSink.reserve(1);
+        if (p) {
+            *p = value;
+            m_rSink.commit(p + 1);
+        } else {
+            fail(1);
+        }
+
+        return *this;
+    }
+
+    template <typename T>
+    BasicEncoder& fixed(uint8_t type, T bits)
+    {
+        uint8_t* p = m_rSink.reserve(1 + sizeof(T));
+        if (p) {
+            p[0] = type;
+            storeBigEndian(p + 1, bits);
+            m_rSink.commit(p + 1 + sizeof(T));
+        } else {
+            fail(1 + sizeof(T));
+        }
+
+        return *this;
+    }
+
+    BasicEncoder& string(uint8_t major, const void* data, size_t len)
+    {
+        uint8_t* p = len <= SIZE_MAX - 9 ? m_rSink.reserve(headSize(len) + len) : nullptr;
+        if (p) {
+            p = writeHead(p, major, len);
+            memcpy(p, data, len);
+            m_rSink.commit(p + len);
+        } else {
+            fail(headSize(len) + len);
+        }
+
+        return *this;
+    }
+
+    BasicEncoder& raw(const uint8_t* data, size_t len)
+    {
+        uint8_t* p = m_rSink.reserve(len);
+        if (p) {
+            memcpy(p, data, len);
+            m_rSink.commit(p + len);
+        } else {
+            fail(len);
+        }
+
+        return *this;
+    }
+
+    void fail(size_t len)
+    {
+        m_rSink.overflow(len);
+        this->encoderError(CborErrorOutOfMemory);
+    }
+
+    Sink& m_rSink;
+};
+
+
+//-----------------------------------------------------------------------------
+
+template <typename Sink, typename Errors, typename T>
+inline BasicEncoder<Sink, Errors>& operator << (BasicEncoder<Sink, Errors>& encoder, const T& value)
+{
+    return encoder.encode(value);
+}
+
+
+//-----------------------------------------------------------------------------
+// Basic Decoder
+//-----------------------------------------------------------------------------
+
+/**
+ * Decoder reading directly from a buffer. Containers are headers as well,
+ * enterArray() returns the number of items or CborIndefiniteLength, in which
+ * case items are read until atBreak() and leaveContainer() skips the break.
+ * After an error all reads return zero values.
+ */
+template <typename Errors = DefaultErrors>
+class BasicDecoder : public Errors
+{
+
+public:
+
+    BasicDecoder(const uint8_t* pBuffer, size_t buffer_size)
+        : m_p(pBuffer), m_pEnd(pBuffer + buffer_size), m_failed(false) { }
+
+    CborType type() const
+    {
+        if (m_p == m_pEnd)
+            return CborInvalidType;
+
+        uint8_t major = m_p[0] & 0xe0;
+        if (major != CborSimpleType)
+            return (CborType)major;
+
+        switch (m_p[0] & 0x1f) {
+        case 20: case 21: return CborBooleanType;
+        case 22: return CborNullType;
+        case 23: return CborUndefinedType;
+        case 25: return CborHalfFloatType;
+        case 26: return CborFloatType;
+        case 27: return CborDoubleType;
+        default: return CborSimpleType;
+        }
+    }
+
+    bool atEnd() const { return m_p == m_pEnd; }
+
+    bool atBreak() const { return m_p != m_pEnd && m_p[0] == 0xff; }
+
+    uint64_t decodeUint() { return argument(CborIntegerType); }
+
+    int64_t decodeInt()
+    {
+        bool negative = m_p != m_pEnd && (m_p[0] & 0xe0) == NegativeIntegerType;
+
+        uint64_t value = argument(negative ? NegativeIntegerType : (uint8_t)CborIntegerType);
+        if (value > (uint64_t)INT64_MAX)
+            return fail(CborErrorDataTooLarge);
+
+        return negative ? -1 - (int64_t)value : (int64_t)value;
+    }
+
+    bool decodeBool()
+    {
+        if (m_p == m_pEnd || (m_p[0] | 1) != (CborSimpleType | 21))
+            return fail(CborErrorIllegalType);
+
+        return *m_p++ == (CborSimpleType | 21);
+    }
+
+    /* half, single and double precision */
+    double decodeDouble()
+    {
+        size_t size = m_p != m_pEnd && (m_p[0] & 0xe0) == CborSimpleType
+                ? floatSize(m_p[0] & 0x1f) : 0;
+        if (!size)
+            return fail(CborErrorIllegalType);
+        if ((size_t)(m_pEnd - m_p) <= size)
+            return fail(CborErrorUnexpectedEOF);
+
+        const uint8_t* p = m_p + 1;
+        m_p += 1 + size;
+
+        if (size == 2)
+            return halfToFloat(loadBigEndian<uint16_t>(p));
+
+        if (size == 4) {
+            uint32_t bits = loadBigEndian<uint32_t>(p);
+            float value;
+            memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+
+        uint64_t bits = loadBigEndian<uint64_t>(p);
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    /* half and single precision, doubles are rejected as by Decoder */
+    float decodeFloat()
+    {
+        if (m_p != m_pEnd && m_p[0] == CborDoubleType)
+            return (float)fail(CborErrorIllegalType);
+
+        return (float)decodeDouble();
+    }
+
+    /* view of a definite length text string, nullptr on error */
+    const char* decodeString(size_t& len)
+    {
+        return reinterpret_cast<const char*>(string(CborTextStringType, len));
+    }
+
+    const uint8_t* decodeBytes(size_t& len) { return string(CborByteStringType, len); }
+
+#if !defined(TINYCBOR_EMBEDDED)
+    std::string decodeString()
+    {
+        size_t len;
+        const char* str = decodeString(len);
+        return str ? std::string(str, len) : std::string();
+    }
+#endif
+
+    CborTag decodeTag() { return argument(CborTagType); }
+
+    size_t enterArray() { return container(CborArrayType); }
+
+    size_t enterMap() { return container(CborMapType); }
+
+    /* after the items of a container entered with CborIndefiniteLength */
+    void leaveContainer()
+    {
+        if (!atBreak())
+            fail(CborErrorUnexpectedBreak);
+        else
+            ++m_p;
+    }
+
+    /**
+     * Skip the next item including nested items, without recursion. Deeper
+     * nesting than TINYCBOR_MAX_DEPTH fails with CborErrorNestingTooDeep.
+     */
+    void skip()
+    {
+        /* items left in each open container, CborIndefiniteLength up to a break */
+        size_t pending[TINYCBOR_MAX_DEPTH];
+        size_t depth = 0;
+        size_t items = 1;
+        bool tagged = false;
+
+        for (;;) {
+            if (!items || (items == CborIndefiniteLength && atBreak() && !tagged)) {
+                if (items)
+                    ++m_p;
+                if (!depth)
+                    return;
+                items = pending[--depth];
+                continue;
+            }
+            if (m_p == m_pEnd)
+                return (void)fail(CborErrorUnexpectedEOF);
+
+            uint8_t major = m_p[0] & 0xe0;
+            if (items != CborIndefiniteLength)
+                --items;
+
+            if ((m_p[0] & 0x1f) == 31) {
+                if (major == CborByteStringType || major == CborTextStringType) {
+                    skipChunks(major);
+                    if (m_failed)
+                        return;
+                } else if (major == CborArrayType || major == CborMapType) {
+                    if (depth == TINYCBOR_MAX_DEPTH)
+                        return (void)fail(CborErrorNestingTooDeep);
+                    pending[depth++] = items;
+                    items = CborIndefiniteLength;
+                    ++m_p;
+                } else {
+                    return (void)fail(major == CborSimpleType
+                            ? CborErrorUnexpectedBreak : CborErrorIllegalType);
+                }
+                tagged = false;
+                continue;
+            }
+
+            uint64_t value;
+            const uint8_t* p = readHead(m_p, m_pEnd, value);
+            if (!p)
+                return (void)fail(CborErrorUnexpectedEOF);
+            m_p = p;
+
+            if (major == CborTagType) {
+                if (items != CborIndefiniteLength)
+                    ++items;
+                tagged = true;
+                continue;
+            }
+            tagged = false;
+
+            if (major == CborByteStringType || major == CborTextStringType) {
+                if (value > (uint64_t)(m_pEnd - m_p))
+                    return (void)fail(CborErrorUnexpectedEOF);
+                m_p += value;
+            } else if (major == CborArrayType || major == CborMapType) {
+                /* every item takes at least one byte */
+                if (value > (uint64_t)(m_pEnd - m_p))
+                    return (void)fail(CborErrorUnexpectedEOF);
+                if (depth == TINYCBOR_MAX_DEPTH)
+                    return (void)fail(CborErrorNestingTooDeep);
+                pending[depth++] = items;
+                items = (size_t)(major == CborMapType ? 2 * value : value);
+            }
+        }
+    }
+
+    const uint8_t* position() const { return m_p; }
+
+private:
+
+    /* tinycbor has no CborType for negative integers */
+    static const uint8_t NegativeIntegerType = 0x20;
+
+    /* stops decoding, every following read fails */
+    uint64_t fail(CborError err)
+    {
+        this->decoderError(err);
+        m_p = m_pEnd;
+        m_failed = true;
+        return 0;
+    }
+
+    /* chunks of an indefinite length string up to the break */
+    void skipChunks(uint8_t major)
+    {
+        ++m_p;
+
+        while (!atBreak()) {
+            if (m_p == m_pEnd)
+                return (void)fail(CborErrorUnexpectedEOF);
+            if ((m_p[0] & 0xe0) != major || (m_p[0] & 0x1f) == 31)
+                return (void)fail(CborErrorIllegalType);
+
+            uint64_t len;
+            const uint8_t* p = readHead(m_p, m_pEnd, len);
+            if (!p || len > (uint64_t)(m_pEnd - p))
+                return (void)fail(CborErrorUnexpectedEOF);
+            m_p = p + len;
+        }
+
+        ++m_p;
+    }
+
+    static size_t floatSize(uint8_t info)
+    {
+        return info == 25 ? 2 : info == 26 ? 4 : info == 27 ? 8 : 0;
+    }
+
+    uint64_t argument(uint8_t major)
+    {
+        if (m_p == m_pEnd)
+            return fail(CborErrorUnexpectedEOF);
+        if ((m_p[0] & 0xe0) != major)
+            return fail(CborErrorIllegalType);
+
+        uint64_t value;
+        const uint8_t* p = readHead(m_p, m_pEnd, value);
+        if (!p)
+            return fail((m_p[0] & 0x1f) == 31 ? CborErrorUnknownLength : CborErrorUnexpectedEOF);
+
+        m_p = p;
+        return value;
+    }
+
+    const uint8_t* string(uint8_t major, size_t& len)
+    {
+        uint64_t length = argument(major);
+        if (length > (uint64_t)(m_pEnd - m_p)) {
+            fail(CborErrorUnexpectedEOF);
+            length = 0;
+        }
+
+        len = (size_t)length;
+        if (m_failed)
+            return nullptr;
+
+        const uint8_t* p = m_p;
+        m_p += len;
+        return p;
+    }
+
+    size_t container(uint8_t major)
+    {
+        if (m_p != m_pEnd && m_p[0] == (major | 31)) {
+            ++m_p;
+            return CborIndefiniteLength;
+        }
+
+        uint64_t count = argument(major);
+        /* every item takes at least one byte */
+        if (count > (uint64_t)(m_pEnd - m_p))
+            return fail(CborErrorUnexpectedEOF);
+
+        return (size_t)count;
+    }
+
+    const uint8_t* m_p;
+    const uint8_t* m_pEnd;
+    bool m_failed;
+};
+
+
+//-----------------------------------------------------------------------------
+
+
+}
+
+#endif /* TINYCBORSTATIC_HPP_ */
@@ -0,0 +1,399 @@
+/**
+ * @file TinyCborTimeSeries.hpp
+ *
+ * @brief Compressed numeric series: delta/zig-zag varints for integers,
+ *        Gorilla style XOR compression for floats
+ */
+
+#ifndef TINYCBORTIMESERIES_HPP_
+#define TINYCBORTIMESERIES_HPP_
+
+#include "TinyCborWrapper.hpp"
+
+namespace CBOR {
+
+
+//-----------------------------------------------------------------------------
+// Series Types
+//-----------------------------------------------------------------------------
+
+/* application specific tags, change them if they collide with your protocol */
+const CborTag TagIntSeries = 0x74730001;
+const CborTag TagFloatSeries = 0x74730002;
+
+
+//-----------------------------------------------------------------------------
+
+/**
+ * Integers, e.g. timestamps or counters, stored as zig-zag varints of the
+ * differences between consecutive values.
+ * Encoded as TagIntSeries(bytes(varint count, varint deltas...)).
+ */
+struct IntSeries
+{
+    std::vector<int64_t> values;
+};
+
+
+//-----------------------------------------------------------------------------
+
+/**
+ * Slowly varying floats stored as XOR with the previous value, only the
+ * meaningful bits between leading and trailing zeros are kept.
+ * Encoded as TagFloatSeries(bytes(varint count, bit stream)).
+ */
+struct FloatSeries
+{
+    std::vector<double> values;
+};
+
+
+//-----------------------------------------------------------------------------
+// Bit Streams
+//-----------------------------------------------------------------------------
+
+inline void writeVarint(std::vector<uint8_t>& out, uint64_t value)
+{
+    while (value >= 0x80) {
+        out.push_back((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((uint8_t)value);
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline const uint8_t* readVarint(const uint8_t* p, const uint8_t* pEnd, uint64_t& value)
+{
+    value = 0;
+
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        if (p == pEnd)
+            throw DecoderException(CborErrorUnexpectedEOF);
+
+        uint8_t byte = *p++;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return p;
+    }
+
+    throw DecoderException(CborErrorIllegalNumber);
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline uint64_t zigZag(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline int64_t unZigZag(uint64_t value)
+{
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+
+//-----------------------------------------------------------------------------
+
+class BitWriter
+{
+
+public:
+
+    BitWriter(std::vector<uint8_t>& out) : m_rOut(out), m_bits(0), m_count(0) { }
+
+    /* append the lowest count bits of value, msb first, count <= 64 */
+    void write(uint64_t value, unsigned count)
+    {
+        while (count) {
+            unsigned n = std::min(count, 32u - m_count);
+            uint32_t chunk = (uint32_t)(value >> (count - n)) & (uint32_t)((1ull << n) - 1);
+            m_bits = (m_bits << n) | chunk;
+            m_count += n;
+            count -= n;
+
+            while (m_count >= 8) {
+                m_count -= 8;
+                m_rOut.push_back((uint8_t)(m_bits >> m_count));
+            }
+        }
+    }
+
+    /* pad the last byte with zero bits */
+    void flush()
+    {
+        if (m_count)
+            m_rOut.push_back((uint8_t)(m_bits << (8 - m_count)));
+        m_count = 0;
+    }
+
+private:
+
+    std::vector<uint8_t>& m_rOut;
+    uint64_t m_bits;
+    unsigned m_count;
+};
+
+
+//-----------------------------------------------------------------------------
+
+class BitReader
+{
+
+public:
+
+    BitReader(const uint8_t* p, const uint8_t* pEnd)
+        : m_p(p), m_pEnd(pEnd), m_bits(0), m_count(0) { }
+
+    uint64_t read(unsigned count)
+    {
+        uint64_t value = 0;
+
+        while (count) {
+            if (!m_count) {
+                if (m_p == m_pEnd)
+                    throw DecoderException(CborErrorUnexpectedEOF);
+                m_bits = *m_p++;
+                m_count = 8;
+            }
+
+            unsigned n = std::min(count, m_count);
+            m_count -= n;
+            value = (value << n) | ((m_bits >> m_count) & ((1u << n) - 1));
+            count -= n;
+        }
+
+        return value;
+    }
+
+private:
+
+    const uint8_t* m_p;
+    const uint8_t* m_pEnd;
+    uint32_t m_bits;
+    unsigned m_count;
+};
+
+
+//-----------------------------------------------------------------------------
+// Series Codec
+//-----------------------------------------------------------------------------
+
+inline Encoder& operator << (Encoder& container, const IntSeries& series)
+{
+    std::vector<uint8_t> payload;
+    payload.reserve(2 + series.values.size() * 2);
+    writeVarint(payload, series.values.size());
+
+    /* differences wrap around, so the full int64_t range round trips */
+    uint64_t prev = 0;
+    for (size_t i = 0; i < series.values.size(); ++i) {
+        uint64_t value = (uint64_t)series.values[i];
+        writeVarint(payload, zigZag((int64_t)(value - prev)));
+        prev = value;
+    }
+
+    container.encodeTag(TagIntSeries);
+    return container.encodeBytes(payload.data(), payload.size());
+}
+
+
+//-----------------------------------------------------------------------------
+
+/* also accepts a plain array of integers */
+inline Decoder& operator >> (Decoder& container, IntSeries& series)
+{
+    if (!container.isTag()) {
+        container.decodeNumbers(series.values);
+        return container;
+    }
+
+    CborTag tag;
+    CborError err = cbor_value_get_tag(&container.getIterator(), &tag);
+    if (err != CborNoError)
+        throw DecoderException(err);
+    if (tag != TagIntSeries)
+        throw DecoderException(CborErrorInappropriateTagForType);
+    container.next();
+
+    size_t len;
+    const uint8_t* p = container.decodeStringView(len);
+    const uint8_t* pEnd = p + len;
+
+    uint64_t count;
+    p = readVarint(p, pEnd, count);
+    /* every value takes at least one byte */
+    if (count > (uint64_t)(pEnd - p))
+        throw DecoderException(CborErrorUnexpectedEOF);
+
+    series.values.resize((size_t)count);
+
+    uint64_t prev = 0;
+    for (size_t i = 0; i < series.values.size(); ++i) {
+        uint64_t delta;
+        p = readVarint(p, pEnd, delta);
+        prev += (uint64_t)unZigZag(delta);
+        series.values[i] = (int64_t)prev;
+    }
+
+    return container;
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline unsigned leadingZeros(uint64_t value)
+{
+#if defined(__GNUC__)
+    return value ? __builtin_clzll(value) : 64;
+#else
+    unsigned n = 0;
+    for (uint64_t bit = 1ull << 63; bit && !(value & bit); bit >>= 1)
+        ++n;
+    return n;
+#endif
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline unsigned trailingZeros(uint64_t value)
+{
+#if defined(__GNUC__)
+    return value ? __builtin_ctzll(value) : 64;
+#else
+    unsigned n = 0;
+    for (uint64_t bit = 1; bit && !(value & bit); bit <<= 1)
+        ++n;
+    return n;
+#endif
+}
+
+
+//-----------------------------------------------------------------------------
+
+/**
+ * Per value: '0' if equal to the previous one, '10' + meaningful bits if
+ * they fit into the previous window, else '11' + 5 bit leading zero count +
+ * 6 bit length (64 stored as 0) + meaningful bits.
+ */
+inline Encoder& operator << (Encoder& container, const FloatSeries& series)
+{
+    std::vector<uint8_t> payload;
+    payload.reserve(10 + series.values.size() * 4);
+    writeVarint(payload, series.values.size());
+
+    BitWriter bits(payload);
+    uint64_t prev = 0;
+    unsigned prev_leading = 65;
+    unsigned prev_trailing = 0;
+
+    for (size_t i = 0; i < series.values.size(); ++i) {
+        uint64_t value;
+        memcpy(&value, &series.values[i], sizeof(value));
+
+        if (i == 0) {
+            bits.write(value, 64);
+            prev = value;
+            continue;
+        }
+
+        uint64_t x = value ^ prev;
+        prev = value;
+
+        if (!x) {
+            bits.write(0, 1);
+            continue;
+        }
+
+        unsigned leading = std::min(leadingZeros(x), 31u);
+        unsigned trailing = trailingZeros(x);
+
+        if (prev_leading <= leading && prev_trailing <= trailing) {
+            bits.write(2, 2);
+            bits.write(x >> prev_trailing, 64 - prev_leading - prev_trailing);
+        } else {
+            unsigned length = 64 - leading - trailing;
+            bits.write(3, 2);
+            bits.write(leading, 5);
+            bits.write(length & 63, 6);
+            bits.write(x >> trailing, length);
+            prev_leading = leading;
+            prev_trailing = trailing;
+        }
+    }
+    bits.flush();
+
+    container.encodeTag(TagFloatSeries);
+    return container.encodeBytes(payload.data(), payload.size());
+}
+
+
+//-----------------------------------------------------------------------------
+
+/* also accepts a plain array of floats */
+inline Decoder& operator >> (Decoder& container, FloatSeries& series)
+{
+    if (!container.isTag()) {
+        container.decodeNumbers(series.values);
+        return container;
+    }
+
+    CborTag tag;
+    CborError err = cbor_value_get_tag(&container.getIterator(), &tag);
+    if (err != CborNoError)
+        throw DecoderException(err);
+    if (tag != TagFloatSeries)
+        throw DecoderException(CborErrorInappropriateTagForType);
+    container.next();
+
+    size_t len;
+    const uint8_t* p = container.decodeStringView(len);
+    const uint8_t* pEnd = p + len;
+
+    uint64_t count;
+    p = readVarint(p, pEnd, count);
+    /* every value takes at least one bit */
+    if (count > (uint64_t)(pEnd - p) * 8)
+        throw DecoderException(CborErrorUnexpectedEOF);
+
+    series.values.resize((size_t)count);
+
+    BitReader bits(p, pEnd);
+    uint64_t prev = 0;
+    unsigned leading = 0;
+    unsigned length = 64;
+
+    for (size_t i = 0; i < series.values.size(); ++i) {
+        if (i == 0) {
+            prev = bits.read(64);
+        } else if (bits.read(1)) {
+            if (bits.read(1)) {
+                leading = (unsigned)bits.read(5);
+                length = (unsigned)bits.read(6);
+                if (!length)
+                    length = 64;
+                if (leading + length > 64)
+                    throw DecoderException(CborErrorIllegalNumber);
+            }
+            prev ^= bits.read(length) << (64 - leading - length);
+        }
+
+        memcpy(&series.values[i], &prev, sizeof(prev));
+    }
+
+    return container;
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+}
+
+#endif /* TINYCBORTIMESERIES_HPP_ */
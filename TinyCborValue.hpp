@@ -0,0 +1,317 @@
+/**
+ * @file TinyCborValue.hpp
+ *
+ * @brief Dynamic CBOR value tree for schema-less payloads
+ */
+
+#ifndef TINYCBORVALUE_HPP_
+#define TINYCBORVALUE_HPP_
+
+#include "TinyCborWrapper.hpp"
+
+/* containers and tags decodeValue() accepts nested in each other */
+#ifndef TINYCBORVALUE_MAX_DEPTH
+#define TINYCBORVALUE_MAX_DEPTH 64
+#endif
+
+namespace CBOR {
+
+
+//-----------------------------------------------------------------------------
+// CBOR Value
+//-----------------------------------------------------------------------------
+
+enum ValueType
+{
+    ValueNull,
+    ValueUndefined,
+    ValueBool,
+    ValueUint,
+    ValueNegInt,
+    ValueFloat,
+    ValueDouble,
+    ValueString,
+    ValueBytes,
+    ValueArray,
+    ValueMap,
+    ValueTag,
+    ValueSimple
+};
+
+
+//-----------------------------------------------------------------------------
+
+/**
+ * Node of a value tree, all nodes and copied strings live in an Arena.
+ * Definite length strings are views into the decoded buffer, which has to
+ * outlive the tree.
+ */
+struct Value
+{
+    ValueType type;
+
+    union {
+        bool boolean;
+
+        /* magnitude for ValueNegInt, see asInt() */
+        uint64_t uint;
+
+        double real;
+
+        struct {
+            const uint8_t* data;
+            size_t length;
+        } str;
+
+        /* maps store size key/value pairs in 2 * size items */
+        struct {
+            Value* items;
+            size_t size;
+        } container;
+
+        struct {
+            CborTag tag;
+            Value* item;
+        } tagged;
+    };
+
+    int64_t asInt() const
+    {
+        return type == ValueNegInt ? -1 - (int64_t)uint : (int64_t)uint;
+    }
+
+    std::string asString() const
+    {
+        return std::string(reinterpret_cast<const char*>(str.data), str.length);
+    }
+
+    size_t size() const { return container.size; }
+
+    const Value& operator[](size_t index) const { return container.items[index]; }
+
+    const Value& key(size_t index) const { return container.items[2 * index]; }
+
+    const Value& value(size_t index) const { return container.items[2 * index + 1]; }
+
+    /* linear lookup of a text string key, nullptr if missing */
+    const Value* find(const char* name) const
+    {
+        size_t len = strlen(name);
+
+        for (size_t i = 0; i < container.size; ++i) {
+            const Value& k = key(i);
+            if (k.type == ValueString && k.str.length == len
+                    && memcmp(k.str.data, name, len) == 0)
+                return &value(i);
+        }
+
+        return nullptr;
+    }
+};
+
+
+//-----------------------------------------------------------------------------
+
+inline void decodeValue(DecoderCursor& cursor, Token& token, Value& value, Arena& arena,
+        size_t max_depth)
+{
+    CborError err;
+
+    switch (token.type) {
+    case TokenUint:
+        value.type = ValueUint;
+        value.uint = token.value;
+        break;
+
+    case TokenNegInt:
+        value.type = ValueNegInt;
+        value.uint = token.value;
+        break;
+
+    case TokenBool:
+        value.type = ValueBool;
+        value.boolean = token.value != 0;
+        break;
+
+    case TokenNull:
+        value.type = ValueNull;
+        break;
+
+    case TokenUndefined:
+        value.type = ValueUndefined;
+        break;
+
+    case TokenSimple:
+        value.type = ValueSimple;
+        value.uint = token.value;
+        break;
+
+    case TokenFloat:
+        value.type = cbor_value_is_double(&token.item) ? ValueDouble : ValueFloat;
+        value.real = token.real;
+        break;
+
+    case TokenString:
+    case TokenBytes:
+        value.type = token.type == TokenString ? ValueString : ValueBytes;
+
+        if (token.data) {
+            value.str.data = token.data;
+            value.str.length = token.length;
+        } else {
+            /* chunked strings are joined into the arena */
+            size_t len;
+            err = cbor_value_calculate_string_length(&token.item, &len);
+            if (err != CborNoError)
+                throw DecoderException(err);
+
+            uint8_t* pData = arena.allocate<uint8_t>(++len);
+            if (token.type == TokenString)
+                err = cbor_value_copy_text_string(
+                        &token.item, reinterpret_cast<char*>(pData), &len, nullptr);
+            else
+                err = cbor_value_copy_byte_string(&token.item, pData, &len, nullptr);
+            if (err != CborNoError)
+                throw DecoderException(err);
+
+            value.str.data = pData;
+            value.str.length = len;
+        }
+        break;
+
+    case TokenTag:
+        if (!max_depth)
+            throw DecoderException(CborErrorNestingTooDeep);
+        
+        value.type = ValueTag;
+        value.tagged.tag = token.value;
+        value.tagged.item = arena.allocate<Value>(1);
+
+        if (!cursor.next(token) || token.type == TokenEnd)
+            throw DecoderException(CborErrorUnexpectedEOF);
+        decodeValue(cursor, token, *value.tagged.item, arena, max_depth - 1);
+        break;
+
+    case TokenArray:
+    case TokenMap: {
+        if (!max_depth)
+            throw DecoderException(CborErrorNestingTooDeep);
+        
+        bool is_map = token.type == TokenMap;
+        value.type = is_map ? ValueMap : ValueArray;
+
+        /* every item takes at least one byte, don't trust larger counts */
+        size_t available = parserEnd(token.item) - cbor_value_get_next_byte(&token.item);
+        size_t capacity = 8;
+        if (token.length != CborIndefiniteLength)
+            capacity = std::min(is_map ? 2 * token.length : token.length, available);
+
+        Value* pItems = arena.allocate<Value>(capacity);
+        size_t count = 0;
+
+        while (cursor.next(token) && token.type != TokenEnd) {
+            if (count == capacity) {
+                capacity = 2 * capacity + 2;
+                Value* pGrown = arena.allocate<Value>(capacity);
+                std::copy(pItems, pItems + count, pGrown);
+                pItems = pGrown;
+            }
+            decodeValue(cursor, token, pItems[count++], arena, max_depth - 1);
+        }
+
+        if (is_map && (count & 1))
+            throw DecoderException(CborErrorUnexpectedEOF);
+
+        value.container.items = pItems;
+        value.container.size = is_map ? count / 2 : count;
+        break;
+    }
+
+    default:
+        throw DecoderException(CborErrorUnexpectedBreak);
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+
+/**
+ * Decode the next item of the container into a tree allocated from arena.
+ * The tree is released with arena.reset(). Containers and tags nested 
+ * deeper than max_depth throw CborErrorNestingTooDeep, as the decoding 
+ * recurses.
+ */
+inline Value& decodeValue(Decoder& container, Arena& arena, 
+        size_t max_depth = TINYCBORVALUE_MAX_DEPTH)
+{
+    DecoderCursor cursor(container);
+    Token token;
+
+    if (!cursor.next(token))
+        throw DecoderException(CborErrorUnexpectedEOF);
+
+    Value* pRoot = arena.allocate<Value>(1);
+    decodeValue(cursor, token, *pRoot, arena, max_depth);
+
+    return *pRoot;
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline Encoder& operator << (Encoder& container, const Value& value)
+{
+    switch (value.type) {
+    case ValueNull:
+        return container.encodeNull();
+    case ValueUndefined:
+        return container.encodeUndefined();
+    case ValueBool:
+        return container.encode(CBool(value.boolean));
+    case ValueUint:
+        return container.encode(CUint(value.uint));
+    case ValueNegInt: {
+        container.ensure(9);
+        CborError err = cbor_encode_negative_int(&container.getEncoder(), value.uint + 1);
+        container.check(err);
+        return container;
+    }
+    case ValueFloat:
+        return container.encode(CFloat((float)value.real));
+    case ValueDouble:
+        return container.encode(CDouble(value.real));
+    case ValueString:
+        return container.encodeString(
+                reinterpret_cast<const char*>(value.str.data), value.str.length);
+    case ValueBytes:
+        return container.encodeBytes(value.str.data, value.str.length);
+    case ValueSimple:
+        return container.encodeSimple((uint8_t)value.uint);
+    case ValueTag:
+        container.encodeTag(value.tagged.tag);
+        return container << *value.tagged.item;
+    case ValueArray:
+    case ValueMap: {
+        bool is_map = value.type == ValueMap;
+        size_t count = is_map ? 2 * value.container.size : value.container.size;
+        Encoder& inner = is_map
+                ? createMap(container, value.container.size)
+                : createArray(container, value.container.size);
+
+        for (size_t i = 0; i < count; ++i)
+            inner << value.container.items[i];
+
+        return end(inner);
+    }
+    }
+
+    return container;
+}
+
+
+//-----------------------------------------------------------------------------
+
+
+}
+
+#endif /* TINYCBORVALUE_HPP_ */
@@ -10,890 +10,4843 @@
 #define TINYCBORWRAPPER_HPP_
 
 #include <cbor.h>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <limits>
+#include <type_traits>
 #include <string>
 #include <vector>
+#include <array>
+#include <map>
+#include <unordered_map>
+#include <tuple>
+#include <utility>
 #include <initializer_list>
 #include <functional>
+#include <new>
+#if __cplusplus >= 201703L
+#include <optional>
+#include <memory_resource>
+#endif
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/uio.h>
+#endif
+
+#include "TinyCborPrimitives.hpp"
+
+/* primitive items are encoded and decoded inline instead of calling into 
+ * tinycbor, which only handles the rare cases. Define as 0 to route every 
+ * item through tinycbor. */
+#ifndef TINYCBORWRAPPER_NATIVE
+#define TINYCBORWRAPPER_NATIVE 1
+#endif
+
+/**
+ * The fast paths read and write fields of CborEncoder and CborValue that 
+ * aren't part of the tinycbor API. Their layout is the one of tinycbor 0.5, 
+ * 0.6 moved the pointers into unions. Check out a 0.5 release in the 
+ * submodule, e.g. git -C tinycbor checkout v0.5.4.
+ */
+#if !defined(TINYCBOR_VERSION_MAJOR) || TINYCBOR_VERSION_MAJOR != 0 || TINYCBOR_VERSION_MINOR != 5
+#error "TinyCborWrapper.hpp requires tinycbor 0.5.x"
+#endif
 
 namespace CBOR {
 
 
 //-----------------------------------------------------------------------------
-// CBOR Types
+// tinycbor 0.5 Internals
 //-----------------------------------------------------------------------------
 
-template <class TSrc, class TDst>
-struct CBORValue
+/* every access to private encoder and iterator state goes through these */
+
+/* write position, only valid without overflow */
+inline uint8_t* encoderPosition(const CborEncoder& encoder) { return encoder.data.ptr; }
+
+inline void setEncoderPosition(CborEncoder& encoder, uint8_t* p) { encoder.data.ptr = p; }
+
+/* end of the buffer, nullptr once the encoder overflowed and counts bytes */
+inline const uint8_t* encoderEnd(const CborEncoder& encoder) { return encoder.end; }
+
+inline void setEncoderEnd(CborEncoder& encoder, const uint8_t* pEnd) { encoder.end = pEnd; }
+
+/* bytes left at the write position, 0 after an overflow */
+inline size_t encoderRoom(const CborEncoder& encoder)
 {
-    explicit CBORValue(TDst& val) : value(val) { }
-    operator TDst() { return value; }
+    return encoder.end ? (size_t)(encoder.end - encoder.data.ptr) : 0;
+}
+
+/* switch to counting len more missing bytes, like tinycbor on a full buffer */
+inline void overflowEncoder(CborEncoder& encoder, size_t len)
+{
+    if (encoder.end) {
+        encoder.end = nullptr;
+        encoder.data.bytes_needed = 0;
+    }
+    encoder.data.bytes_needed += len;
+}
+
+/* items a definite container still expects, tinycbor counts them down */
+inline size_t encoderRemaining(const CborEncoder& encoder) { return encoder.remaining; }
+
+inline void setEncoderRemaining(CborEncoder& encoder, size_t remaining) 
+{ 
+    encoder.remaining = remaining; 
+}
+
+/* count items written without tinycbor */
+inline void countEncoderItems(CborEncoder& encoder, size_t count = 1)
+{
+    encoder.remaining -= std::min(encoder.remaining, count);
+}
+
+inline bool isEncoderLengthUnknown(const CborEncoder& encoder)
+{
+    return (encoder.flags & CborIteratorFlag_UnknownLength) != 0;
+}
+
+/* end of the input the iterator parses */
+inline const uint8_t* parserEnd(const CborValue& it) { return it.parser->end; }
+
+/* mark a container iterator as exhausted at p, for cbor_value_leave_container() */
+inline void finishContainer(CborValue& it, const uint8_t* p)
+{
+    it.ptr = p;
+    it.remaining = 0;
+    it.type = CborInvalidType;
+}
+
+
+//-----------------------------------------------------------------------------
+// Helpers
+//-----------------------------------------------------------------------------
+
+inline bool isHalfLossless(float value)
+{
+    return value != value || halfToFloat(floatToHalf(value)) == value;
+}
+
+
+//-----------------------------------------------------------------------------
+
+/* batch conversion, uses F16C when compiled with -mf16c (or -march=native) */
+inline void floatsToHalfs(const float* pSrc, uint16_t* pDst, size_t count)
+{
+    size_t i = 0;
     
-    void set(const TSrc& val) { value = val; }
+#if defined(__F16C__)
+    for (; i + 8 <= count; i += 8) {
+        __m128i half = _mm256_cvtps_ph(_mm256_loadu_ps(pSrc + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pDst + i), half);
+    }
+#endif
     
-    TDst& value;
-};
+    for (; i < count; ++i)
+        pDst[i] = floatToHalf(pSrc[i]);
+}
 
-template <class T>
-struct CBORConstValue
+
+//-----------------------------------------------------------------------------
+
+inline void halfsToFloats(const uint16_t* pSrc, float* pDst, size_t count)
 {
-    explicit CBORConstValue(const T& val) : value(val) { }
-    operator T() { return value; }
-    T value;
-};
+    size_t i = 0;
+    
+#if defined(__F16C__)
+    for (; i + 8 <= count; i += 8) {
+        __m128i half = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSrc + i));
+        _mm256_storeu_ps(pDst + i, _mm256_cvtph_ps(half));
+    }
+#endif
+    
+    for (; i < count; ++i)
+        pDst[i] = halfToFloat(pSrc[i]);
+}
 
 
 //-----------------------------------------------------------------------------
 
-struct CNull { };
-struct CUndefined { };
+/**
+ * Types handled by the bulk number paths: float, double and the fixed width 
+ * integers. long double and the character types have no CBOR encoding there.
+ */
+template <typename T>
+struct IsNumber : std::integral_constant<bool, 
+        std::is_same<T, float>::value || std::is_same<T, double>::value 
+        || std::is_same<T, int8_t>::value || std::is_same<T, uint8_t>::value 
+        || std::is_same<T, int16_t>::value || std::is_same<T, uint16_t>::value 
+        || std::is_same<T, int32_t>::value || std::is_same<T, uint32_t>::value 
+        || std::is_same<T, int64_t>::value || std::is_same<T, uint64_t>::value> { };
 
-typedef CBORConstValue<std::string> CString;
-typedef CBORConstValue< std::vector<uint8_t> > CBytes;
-typedef CBORConstValue<int64_t> CInt;
-typedef CBORConstValue<uint64_t> CUint;
-typedef CBORConstValue<bool> CBool;
-typedef CBORConstValue<float> CFloat;
-typedef CBORConstValue<double> CDouble;
+
+//-----------------------------------------------------------------------------
+
+/* FNV-1a with a final mix, seed selects an independent hash function */
+inline uint64_t hashBytes(const void* pData, size_t len, uint64_t seed = 0)
+{
+    const uint8_t* p = static_cast<const uint8_t*>(pData);
+    uint64_t h = 14695981039346656037ull ^ (seed * 0x9e3779b97f4a7c15ull);
+    
+    for (size_t i = 0; i < len; ++i) {
+        h ^= p[i];
+        h *= 1099511628211ull;
+    }
+    
+    h ^= h >> 29;
+    h *= 0xbf58476d1ce4e5b9ull;
+    return h ^ (h >> 32);
+}
 
 
 //-----------------------------------------------------------------------------
 
-template<typename T> using TString = CBORValue<std::string, T>;
-template<typename T> using TBytes = CBORValue<std::vector<uint8_t>, T>;
-template<typename T> using TInt = CBORValue<int64_t, T>;
-template<typename T> using TUint = CBORValue<uint64_t, T>;
-template<typename T> using TBool = CBORValue<bool, T>;
-template<typename T> using TFloat = CBORValue<float, T>;
-template<typename T> using TDouble = CBORValue<double, T>;
+inline uint8_t byteSwap(uint8_t v) { return v; }
+
+template <size_t N> struct UIntOfSize;
+template <> struct UIntOfSize<1> { typedef uint8_t type; };
+template <> struct UIntOfSize<2> { typedef uint16_t type; };
+template <> struct UIntOfSize<4> { typedef uint32_t type; };
+template <> struct UIntOfSize<8> { typedef uint64_t type; };
+
+/* reverse the bytes of any number, including floating point types */
+template <typename T>
+inline T byteSwapValue(T value)
+{
+    typename UIntOfSize<sizeof(T)>::type bits;
+    memcpy(&bits, &value, sizeof(bits));
+    bits = byteSwap(bits);
+    memcpy(&value, &bits, sizeof(bits));
+    return value;
+}
+
 
 //-----------------------------------------------------------------------------
 
-class Encoder;
-class Decoder;
-typedef std::function<Encoder&(Encoder&)> tEncoderFn;
-typedef std::function<Decoder&(Decoder&)> tDecoderFn;
+inline constexpr bool nativeLittleEndian()
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return false;
+#else
+    return true;
+#endif
+}
 
 
 //-----------------------------------------------------------------------------
-// Exceptions
+// RFC 8746 typed arrays
 //-----------------------------------------------------------------------------
 
-class EncoderException
+/**
+ * Tag of a typed array holding T, the tag bits are 0b010_f_s_e_ll:
+ * float, signed, little endian and the element size.
+ */
+template <typename T>
+inline CborTag typedArrayTag(bool little_endian = nativeLittleEndian())
 {
-public:
-
-    EncoderException(CborError err) : m_err(err) {} 
+    static_assert(IsNumber<T>::value && sizeof(T) <= 8, "unsupported element type");
     
-    CborError getErrorCode() { return m_err; }
+    CborTag size_bits = sizeof(T) == 1 ? 0 : sizeof(T) == 2 ? 1 : sizeof(T) == 4 ? 2 : 3;
+    CborTag tag = 64;
     
-private:
-    CborError m_err;
-};
+    if (std::is_floating_point<T>::value)
+        tag |= 0x10 | (size_bits - 1);
+    else
+        tag |= (std::is_signed<T>::value ? 0x08 : 0) | size_bits;
+    
+    if (sizeof(T) > 1 && little_endian)
+        tag |= 0x04;
+    
+    return tag;
+}
 
 
 //-----------------------------------------------------------------------------
 
-class DecoderException
+/**
+ * Check whether tag is a typed array with elements of type T, in either byte
+ * order. little_endian receives the byte order of the data.
+ */
+template <typename T>
+inline bool isTypedArrayTag(CborTag tag, bool& little_endian)
 {
-public:
-
-    DecoderException(CborError err) : m_err(err) {} 
+    little_endian = (tag & 0x04) != 0;
     
-    CborError getErrorCode() { return m_err; }
+    if (tag == 68 && std::is_same<T, uint8_t>::value)
+        return true;
     
-private:
-    CborError m_err;
-};
+    return tag == typedArrayTag<T>(false) || tag == typedArrayTag<T>(true);
+}
 
 
 //-----------------------------------------------------------------------------
-// CBorEncoder
+// Memory
 //-----------------------------------------------------------------------------
 
-class Encoder
+/**
+ * Monotonic arena, allocations are released all at once by reset(). 
+ * Blocks are kept for reuse, so reset() is O(1).
+ */
+class Arena
 {
 
 public:
     
-    Encoder(CborEncoder& rEncoder) : m_rEncoder(rEncoder) { }
-
-    virtual ~Encoder() { }
+    Arena(size_t block_size = 4096) 
+        : m_blockSize(block_size), m_pFirst(nullptr), m_pCurrent(nullptr), m_offset(0) { }
     
-    Encoder& encode(const CUint& value) 
-    {   
-        CborError err = cbor_encode_uint(&m_rEncoder, value.value);
-        if (err != CborNoError) 
-            throw EncoderException(err);
-        
-        return *this;
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    
+    ~Arena()
+    {
+        while (m_pFirst) {
+            Block* pNext = m_pFirst->pNext;
+            delete[] reinterpret_cast<uint8_t*>(m_pFirst);
+            m_pFirst = pNext;
+        }
     }
     
-    Encoder& encode(const CInt& value) 
-    {   
-        CborError err = cbor_encode_int(&m_rEncoder, value.value);
-        if (err != CborNoError)
-            throw EncoderException(err);
+    void* allocate(size_t size, size_t align = alignof(std::max_align_t))
+    {
+        if (m_pCurrent) {
+            size_t offset = (m_offset + align - 1) & ~(align - 1);
+            if (offset + size <= m_pCurrent->size) {
+                m_offset = offset + size;
+                return m_pCurrent->data() + offset;
+            }
+        }
         
-        return *this;
+        /* reuse the following block if it is large enough */
+        Block* pNext = m_pCurrent ? m_pCurrent->pNext : m_pFirst;
+        if (!pNext || pNext->size < size + align) {
+            size_t block_size = std::max(m_blockSize, size + align);
+            uint8_t* pRaw = new uint8_t[sizeof(Block) + block_size];
+            Block* pBlock = reinterpret_cast<Block*>(pRaw);
+            pBlock->size = block_size;
+            pBlock->pNext = pNext;
+            if (m_pCurrent)
+                m_pCurrent->pNext = pBlock;
+            else
+                m_pFirst = pBlock;
+            pNext = pBlock;
+        }
+        
+        m_pCurrent = pNext;
+        uintptr_t base = reinterpret_cast<uintptr_t>(m_pCurrent->data());
+        size_t offset = ((base + align - 1) & ~(uintptr_t)(align - 1)) - base;
+        m_offset = offset + size;
+        return m_pCurrent->data() + offset;
     }
     
-    Encoder& encode(const CString& value)
+    template <typename T>
+    T* allocate(size_t count)
     {
-        CborError err = cbor_encode_text_string(
-                &m_rEncoder, value.value.c_str(), value.value.length());
-        if (err != CborNoError)
-            throw EncoderException(err);
-        
-        return *this;
+        return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
     }
     
-    Encoder& encode(const CBytes& value)
+    void reset() 
+    { 
+        m_pCurrent = m_pFirst; 
+        m_offset = 0; 
+    }
+    
+private:
+    
+    struct alignas(std::max_align_t) Block
     {
-        CborError err = cbor_encode_byte_string(
-                &m_rEncoder, value.value.data(), value.value.size());
-        if (err != CborNoError)
-            throw EncoderException(err);
+        Block* pNext;
+        size_t size;
         
-        return *this;
+        uint8_t* data() { return reinterpret_cast<uint8_t*>(this + 1); }
+    };
+    
+    size_t m_blockSize;
+    Block* m_pFirst;
+    Block* m_pCurrent;
+    size_t m_offset;
+};
+
+
+//-----------------------------------------------------------------------------
+
+/**
+ * Free lists of encoder buffers in power of two size classes. It learns the 
+ * size of each message type, so a buffer is usually large enough up front. 
+ * Not thread safe, use one pool per thread, see local().
+ */
+class BufferPool
+{
+
+public:
+    
+    /* 256 bytes up to 1 MiB, larger buffers aren't cached */
+    static const unsigned MinClass = 8;
+    static const unsigned Classes = 13;
+    
+    BufferPool(size_t max_cached = 16) : m_maxCached(max_cached) { }
+    
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+    
+    ~BufferPool()
+    {
+        for (unsigned c = 0; c < Classes; ++c)
+            for (size_t i = 0; i < m_free[c].size(); ++i)
+                delete[] m_free[c][i];
     }
     
-    Encoder& encode(const CBool& value)
+    static BufferPool& local()
     {
-        CborError err = cbor_encode_boolean(&m_rEncoder, value.value);
-        if (err != CborNoError)
-            throw EncoderException(err);
-        
-        return *this;
+        static thread_local BufferPool pool;
+        return pool;
     }
     
-    Encoder& encode(const CFloat& value)
+    /* buffer of at least size bytes, its capacity is rounded up to the class */
+    uint8_t* acquire(size_t size, size_t& capacity)
     {
-        CborError err = cbor_encode_float(&m_rEncoder, value.value);
-        if (err != CborNoError)
-            throw EncoderException(err);
+        unsigned c = sizeClass(size);
+        if (c == Classes) {
+            capacity = size;
+            return new uint8_t[size];
+        }
         
-        return *this;
+        capacity = (size_t)1 << (MinClass + c);
+        if (m_free[c].empty())
+            return new uint8_t[capacity];
+        
+        uint8_t* pBuffer = m_free[c].back();
+        m_free[c].pop_back();
+        return pBuffer;
     }
-
-    Encoder& encode(const CDouble& value)
+    
+    void release(uint8_t* pBuffer, size_t capacity)
     {
-        CborError err = cbor_encode_double(&m_rEncoder, value.value);
-        if (err != CborNoError)
-            throw EncoderException(err);
-        
-        return *this;
+        unsigned c = sizeClass(capacity);
+        if (c < Classes && ((size_t)1 << (MinClass + c)) == capacity 
+                && m_free[c].size() < m_maxCached)
+            m_free[c].push_back(pBuffer);
+        else
+            delete[] pBuffer;
     }
     
-    Encoder& encodeNull()
+    /* expected size of the next message of a type, 0 if unknown */
+    size_t expected(uint32_t type) const
     {
-        CborError err = cbor_encode_null(&m_rEncoder);
-        if (err != CborNoError)
-            throw EncoderException(err);
-        
-        return *this;
+        std::unordered_map<uint32_t, size_t>::const_iterator it = m_sizes.find(type);
+        return it != m_sizes.end() ? it->second : 0;
     }
-
-    Encoder& encodeUndefined()
+    
+    /* the largest recent size wins, the estimate decays slowly towards smaller ones */
+    void record(uint32_t type, size_t size)
     {
-        CborError err = cbor_encode_undefined(&m_rEncoder);
-        if (err != CborNoError)
-            throw EncoderException(err);
-        
-        return *this;
+        size_t& expected = m_sizes[type];
+        expected = std::max(size, expected - expected / 16);
     }
-
-    CborEncoder& getEncoder() { return m_rEncoder; }
     
+private:
     
-protected:
-
-    CborEncoder& m_rEncoder;
-    friend Encoder& operator<<(Encoder&, tEncoderFn);
-    friend Encoder& createArray(Encoder& container, size_t size);
-    friend Encoder& createMap(Encoder& container, size_t size);
+    static unsigned sizeClass(size_t size)
+    {
+        unsigned c = 0;
+        while (c < Classes && ((size_t)1 << (MinClass + c)) < size)
+            ++c;
+        return c;
+    }
+    
+    size_t m_maxCached;
+    std::vector<uint8_t*> m_free[Classes];
+    std::unordered_map<uint32_t, size_t> m_sizes;
 };
 
 
 //-----------------------------------------------------------------------------
 
-class EncoderBuffer : public Encoder
+/**
+ * Standard allocator on an Arena, e.g. for decoded strings and vectors:
+ * std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>>.
+ * Memory is only released by Arena::reset().
+ */
+template <typename T>
+struct ArenaAllocator
 {
-
-public:
+    typedef T value_type;
     
-    EncoderBuffer(size_t buffer_size = 4096) 
-        : Encoder(m_rEncoder), m_pBuffer(new uint8_t[buffer_size]), m_bufferSize(buffer_size)
-    {
-        cbor_encoder_init(&m_rEncoder, m_pBuffer, buffer_size, 0);
-    }
-
-    virtual ~EncoderBuffer() { delete[] m_pBuffer; }
-
-    size_t size() {
-        return cbor_encoder_get_buffer_size(&m_rEncoder, m_pBuffer);
-    }
+    ArenaAllocator(Arena& arena) : pArena(&arena) { }
     
-    uint8_t* getBuffer() { return m_pBuffer; }
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : pArena(other.pArena) { }
     
-    size_t getBufferSize() { return m_bufferSize; }
+    T* allocate(size_t count) { return pArena->allocate<T>(count); }
     
-private:
-
-    CborEncoder m_rEncoder;
-    uint8_t* m_pBuffer;
-    size_t m_bufferSize;
+    void deallocate(T*, size_t) { }
+    
+    Arena* pArena;
 };
 
+template <typename T, typename U>
+bool operator == (const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) 
+{ 
+    return a.pArena == b.pArena; 
+}
+
+template <typename T, typename U>
+bool operator != (const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) 
+{ 
+    return a.pArena != b.pArena; 
+}
+
 
 //-----------------------------------------------------------------------------
 
-class InnerEncoder : public Encoder
+#if __cplusplus >= 201703L
+/* an Arena as std::pmr::memory_resource, e.g. for std::pmr::string */
+class ArenaResource : public std::pmr::memory_resource
 {
+
 public:
     
-    InnerEncoder(Encoder& rOuterEncoder) 
-        : Encoder(m_encoder), m_rOuter(rOuterEncoder) { }
+    ArenaResource(Arena& arena) : m_rArena(arena) { }
     
-    virtual ~InnerEncoder() {
-        cbor_encoder_close_container(&m_rOuter.getEncoder(), &m_encoder);
+private:
+    
+    void* do_allocate(size_t size, size_t align) override
+    {
+        return m_rArena.allocate(size, align);
     }
+    
+    void do_deallocate(void*, size_t, size_t) override { }
+    
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+    
+    Arena& m_rArena;
+};
+#endif
 
-    CborEncoder& getEncoder() { return m_encoder; }
-
-    /* friend functions */
-    friend Encoder& end(Encoder& container);
-    friend Encoder& createMap(Encoder& container, size_t size);
-    friend Encoder& createArray(Encoder& container, size_t size);
-
-
-protected:
 
-    CborEncoder m_encoder;
-    Encoder& m_rOuter;
+//-----------------------------------------------------------------------------
 
-};
+/* object in the arena, on the heap if there is none */
+template <typename T, typename TArg>
+T* createIn(Arena* pArena, TArg& arg)
+{
+    if (!pArena)
+        return new T(arg);
+    
+    return new (pArena->allocate(sizeof(T), alignof(T))) T(arg);
+}
 
 
 //-----------------------------------------------------------------------------
 
-inline Encoder& end(Encoder& container)
+template <typename T>
+void destroyIn(Arena* pArena, T* p)
 {
-    if (InnerEncoder* s = dynamic_cast<InnerEncoder*>(&container)) {
-        Encoder& outer = s->m_rOuter;
-        delete s;
-        return outer;
-    }
-
-    return container;
+    if (pArena)
+        p->~T();
+    else
+        delete p;
 }
 
 
+//-----------------------------------------------------------------------------
+// CBOR Types
 //-----------------------------------------------------------------------------
 
-inline Encoder& createMap(Encoder& container, size_t size)
+template <class TSrc, class TDst>
+struct CBORValue
 {
-    InnerEncoder* pInner = new InnerEncoder(container);
-    
-    CborError err = cbor_encoder_create_map(
-            &container.m_rEncoder, &pInner->getEncoder(), size);
+    explicit CBORValue(TDst& val) : value(val) { }
+    operator TDst() { return value; }
     
-    if (err != CborNoError)
-        throw EncoderException(err);
+    void set(const TSrc& val) { value = val; }
     
-    return *pInner;
-}
+    TDst& value;
+};
 
+template <class T>
+struct CBORConstValue
+{
+    explicit CBORConstValue(const T& val) : value(val) { }
+    operator T() { return value; }
+    T value;
+};
 
 
 //-----------------------------------------------------------------------------
 
-inline Encoder& createArray(Encoder& container, size_t size)
+struct CNull { };
+struct CUndefined { };
+
+typedef CBORConstValue<std::string> CString;
+typedef CBORConstValue< std::vector<uint8_t> > CBytes;
+typedef CBORConstValue<int64_t> CInt;
+typedef CBORConstValue<uint64_t> CUint;
+typedef CBORConstValue<bool> CBool;
+typedef CBORConstValue<float> CFloat;
+typedef CBORConstValue<double> CDouble;
+
+/* float encoded as 3 byte half precision float, rounding to nearest even */
+struct CHalf
 {
-    InnerEncoder* pInner = new InnerEncoder(container);
-    
-    CborError err = cbor_encoder_create_array(
-            &container.m_rEncoder, &pInner->getEncoder(), size);
-    
-    if (err != CborNoError)
-        throw EncoderException(err);
+    explicit CHalf(float val) : value(val) { }
+    operator float() { return value; }
+    float value;
+};
+
+
+//-----------------------------------------------------------------------------
+
+enum FloatEncoding
+{
+    /* CFloat as single, CDouble as double precision */
+    FloatExact,
     
-    return *pInner;
-}
+    /* CFloat and CDouble in the shortest form that keeps the value */
+    FloatShortest
+};
 
 
 //-----------------------------------------------------------------------------
 
-inline tEncoderFn startMap(size_t size = CborIndefiniteLength)
+/**
+ * LengthDefinite: maps and arrays opened without a size are counted and 
+ * their header is rewritten to the definite length when they are closed.
+ * If the buffer has no room for a header wider than 2 bytes the container 
+ * stays indefinite.
+ */
+enum LengthEncoding
 {
-    return std::bind(createMap, std::placeholders::_1, size);
-}
+    LengthIndefinite,
+    LengthDefinite
+};
 
 
 //-----------------------------------------------------------------------------
 
-inline tEncoderFn startArray(size_t size = CborIndefiniteLength)
+/* map key, encoded as integer if it is part of the encoder's KeyDictionary */
+struct CKey
 {
-    return std::bind(createArray, std::placeholders::_1, size);
-}
+    explicit CKey(const char* key) : value(key), length(strlen(key)) { }
+    explicit CKey(const std::string& key) : value(key.c_str()), length(key.length()) { }
+    
+    const char* value;
+    size_t length;
+};
+
+
+
+/* view of numbers to encode as RFC 8746 typed array, see Encoder::encode */
+template <typename T>
+struct CTypedArray
+{
+    CTypedArray(const T* values, size_t count) : data(values), size(count) { }
+    explicit CTypedArray(const std::vector<T>& values) 
+        : data(values.data()), size(values.size()) { }
+    
+    const T* data;
+    size_t size;
+};
 
 
 //-----------------------------------------------------------------------------
 
-inline Encoder& operator << (Encoder& container, const char* str)
+/**
+ * Byte string encoded from the caller's memory. With a GatherList attached 
+ * to the Encoder large payloads are referenced instead of copied, they have 
+ * to stay valid until the output is written. A StringRefTable keeps views 
+ * of them as well.
+ */
+struct CBytesRef
 {
-    return container.encode(CString(str));
-}
+    CBytesRef(const uint8_t* bytes, size_t len) : data(bytes), size(len) { }
+    explicit CBytesRef(const std::vector<uint8_t>& bytes) 
+        : data(bytes.data()), size(bytes.size()) { }
+    
+    const uint8_t* data;
+    size_t size;
+};
 
 
 //-----------------------------------------------------------------------------
 
+/* zero copy view of a decoded typed array, elements are converted on access */
 template <typename T>
-inline Encoder& operator << (Encoder& container, const T& value)
+struct TypedArrayView
 {
-    return container.encode(value);
-}
+    const uint8_t* data;
+    size_t size;
+    bool swapped;
+    
+    T operator[](size_t index) const
+    {
+        T value;
+        memcpy(&value, data + index * sizeof(T), sizeof(T));
+        return swapped ? byteSwapValue(value) : value;
+    }
+    
+    /* the elements can be read in place, if data happens to be aligned */
+    bool isNative() const { return !swapped; }
+};
 
 
 //-----------------------------------------------------------------------------
 
-template <>
-inline Encoder& operator<< <decltype(end)>(Encoder& container, decltype(end)& op)
+template<typename T> using TString = CBORValue<std::string, T>;
+template<typename T> using TBytes = CBORValue<std::vector<uint8_t>, T>;
+template<typename T> using TInt = CBORValue<int64_t, T>;
+template<typename T> using TUint = CBORValue<uint64_t, T>;
+template<typename T> using TBool = CBORValue<bool, T>;
+template<typename T> using TFloat = CBORValue<float, T>;
+template<typename T> using TDouble = CBORValue<double, T>;
+
+//-----------------------------------------------------------------------------
+
+class Encoder;
+class Decoder;
+typedef std::function<Encoder&(Encoder&)> tEncoderFn;
+typedef std::function<Decoder&(Decoder&)> tDecoderFn;
+
+
+//-----------------------------------------------------------------------------
+// Exceptions
+//-----------------------------------------------------------------------------
+
+class EncoderException
 {
-    return op(container);
-}
+public:
+
+    EncoderException(CborError err) : m_err(err) {} 
+    
+    CborError getErrorCode() { return m_err; }
+    
+private:
+    CborError m_err;
+};
 
 
 //-----------------------------------------------------------------------------
 
-inline Encoder& operator << (Encoder& container, tEncoderFn op)
+class DecoderException
 {
-    return op(container);
-}
+public:
+
+    DecoderException(CborError err) : m_err(err) {} 
+    
+    CborError getErrorCode() { return m_err; }
+    
+private:
+    CborError m_err;
+};
 
 
 //-----------------------------------------------------------------------------
-// CBOR Decoder
+// Key Dictionary
 //-----------------------------------------------------------------------------
 
-class Decoder
+/**
+ * Map keys known to producer and consumer, key n is sent as integer n.
+ * Lookup by name uses a perfect hash (hash and displace), so encoding a 
+ * key costs two hashes and one string compare. Applies to CKey and to the 
+ * string keys of std::map and std::unordered_map.
+ */
+class KeyDictionary
 {
 
 public:
     
-    Decoder(CborValue& position) : m_it(position) { }
-
-    virtual ~Decoder() { }
+    KeyDictionary(std::initializer_list<const char*> keys)
+    {
+        for (const char* key : keys)
+            m_names.push_back(key);
+        build();
+    }
     
-    uint64_t decodeUint() 
-    {   
-        CborError err;
-        uint64_t value_buffer;
+    KeyDictionary(const std::vector<std::string>& keys) : m_names(keys)
+    {
+        build();
+    }
+    
+    /* id of key, -1 if it isn't part of the dictionary */
+    int64_t find(const char* key, size_t len) const
+    {
+        if (m_names.empty())
+            return -1;
         
-        if (cbor_value_get_uint64(&m_it, &value_buffer) != CborNoError)
-            throw DecoderException(err);
+        uint32_t seed = m_seeds[hash(key, len, 0) % m_seeds.size()];
+        int32_t id = m_slots[hash(key, len, seed) & (m_slots.size() - 1)];
         
-        next();
+        if (id < 0 || m_names[id].length() != len || memcmp(m_names[id].data(), key, len) != 0)
+            return -1;
         
-        return value_buffer;
+        return id;
+    }
+    
+    /* name of id, nullptr if unknown */
+    const std::string* name(uint64_t id) const
+    {
+        return id < m_names.size() ? &m_names[id] : nullptr;
     }
     
+    size_t size() const { return m_names.size(); }
     
-    int64_t decodeInt() 
-    {   
-        CborError err;
-        int64_t value_buffer;
-        
-        if ((err = cbor_value_get_int64(&m_it, &value_buffer)) != CborNoError)
-            throw DecoderException(err);
+private:
+    
+    static uint64_t hash(const char* key, size_t len, uint32_t seed)
+    {
+        return hashBytes(key, len, seed);
+    }
+    
+    void build()
+    {
+        size_t n = m_names.size();
+        size_t table_size = 1;
+        while (table_size < 2 * n)
+            table_size <<= 1;
         
-        next();
+        for (size_t i = 0; i < n; ++i)
+            for (size_t j = i + 1; j < n; ++j)
+                if (m_names[i] == m_names[j])
+                    throw EncoderException(CborErrorDuplicateObjectKeys);
         
-        return value_buffer;
+        /* place the largest buckets first, grow the table if a bucket can't be placed */
+        while (!place(table_size))
+            table_size <<= 1;
     }
     
-    
-    std::string decodeString() 
-    {   
-        CborError err;
-        size_t len;
+    bool place(size_t table_size)
+    {
+        size_t n = m_names.size();
+        std::vector< std::vector<int32_t> > buckets((n + 3) / 4 + 1);
         
-        err = cbor_value_calculate_string_length(&m_it, &len);
-        if (err != CborNoError)
-            throw DecoderException(err);
+        for (size_t i = 0; i < n; ++i)
+            buckets[hash(m_names[i].data(), m_names[i].length(), 0) % buckets.size()]
+                .push_back((int32_t)i);
         
-        char* str_val = new char[++len];
-        err = cbor_value_copy_text_string(&m_it, str_val, &len, &m_it);
-        if (err != CborNoError)
-            throw DecoderException(err);
+        std::vector<size_t> order(buckets.size());
+        for (size_t i = 0; i < order.size(); ++i)
+            order[i] = i;
+        std::sort(order.begin(), order.end(), [&buckets](size_t a, size_t b) {
+            return buckets[a].size() > buckets[b].size();
+        });
         
-        std::string ret(str_val);
-        delete[] str_val;
+        m_seeds.assign(buckets.size(), 0);
+        m_slots.assign(table_size, -1);
+        std::vector<size_t> slots;
         
-        return ret;
+        for (size_t b : order) {
+            const std::vector<int32_t>& bucket = buckets[b];
+            uint32_t seed = 1;
+            
+            for (; seed < 4096; ++seed) {
+                slots.clear();
+                for (int32_t id : bucket) {
+                    size_t slot = hash(m_names[id].data(), m_names[id].length(), seed) 
+                            & (table_size - 1);
+                    if (m_slots[slot] >= 0 
+                            || std::find(slots.begin(), slots.end(), slot) != slots.end())
+                        break;
+                    slots.push_back(slot);
+                }
+                if (slots.size() == bucket.size())
+                    break;
+            }
+            
+            if (seed == 4096)
+                return false;
+            
+            m_seeds[b] = seed;
+            for (size_t i = 0; i < bucket.size(); ++i)
+                m_slots[slots[i]] = bucket[i];
+        }
+        
+        return true;
     }
     
+    std::vector<std::string> m_names;
+    std::vector<uint32_t> m_seeds;
+    std::vector<int32_t> m_slots;
+};
+
+
+//-----------------------------------------------------------------------------
+// String References
+//-----------------------------------------------------------------------------
+
+/* stringref extension, http://cbor.schmorp.de/stringref */
+const CborTag TagStringRef = 25;
+const CborTag TagStringRefNamespace = 256;
+
+
+//-----------------------------------------------------------------------------
+
+/**
+ * Strings of one stringref namespace in order of appearance. Used by the 
+ * Encoder to find repeated strings (copies are kept in an Arena) and by the 
+ * Decoder to resolve references (views into the input).
+ */
+class StringRefTable
+{
+
+public:
     
-    std::vector<uint8_t> decodeBytes()
+    struct Entry
     {
-        CborError err;
-        size_t len;
-
-        err = cbor_value_calculate_string_length(&m_it, &len);
-        if (err != CborNoError)
-            throw DecoderException(err);
-        
-        uint8_t* bytes = new uint8_t[len];
-        err = cbor_value_copy_byte_string(&m_it, bytes, &len, &m_it);
-        if (err != CborNoError)
-            throw DecoderException(err);
-        
-        std::vector<uint8_t> ret(bytes, bytes+len);
-        delete[] bytes;
-        
-        return ret;
-    }
+        const uint8_t* data;
+        size_t length;
+        bool text;
+    };
     
+    StringRefTable() : m_arena(1024) { }
     
-    bool decodeBool() 
-    {   
-        CborError err;
-        bool value_buffer;
-        
-        err = cbor_value_get_boolean(&m_it, &value_buffer);
-        if (err != CborNoError)
-            throw DecoderException(err);
-        
-        next();
-        
-        return value_buffer;
+    void clear()
+    {
+        m_entries.clear();
+        m_slots.clear();
+        m_arena.reset();
     }
     
+    /* shortest string worth a reference once index strings are stored */
+    static size_t minLength(size_t index)
+    {
+        return index < 24 ? 3 : index < 256 ? 4 : index < 65536 ? 5 
+                : index < 4294967296ull ? 7 : 11;
+    }
     
-    float decodeFloat() 
-    {   
-        CborError err;
-        float value_buffer;
+    /**
+     * Index of an equal string emitted before, -1 if there is none. In that 
+     * case the string is recorded if it is long enough, as a copy or as a 
+     * view if data outlives the table.
+     */
+    int64_t reference(const uint8_t* data, size_t len, bool text, bool copy = true)
+    {
+        if (len < 3)
+            return -1;
         
-        err = cbor_value_get_float(&m_it, &value_buffer);
-        if (err != CborNoError)
-            throw DecoderException(err);
+        uint64_t h = hashBytes(data, len, text);
+        size_t mask = m_slots.size() - 1;
         
-        next();
+        if (!m_slots.empty()) {
+            for (size_t i = h & mask; m_slots[i] >= 0; i = (i + 1) & mask) {
+                const Entry& entry = m_entries[m_slots[i]];
+                if (entry.length == len && entry.text == text 
+                        && memcmp(entry.data, data, len) == 0)
+                    return m_slots[i];
+            }
+        }
         
-        return value_buffer;
+        if (len >= minLength(m_entries.size())) {
+            if (copy) {
+                uint8_t* pCopy = m_arena.allocate<uint8_t>(len);
+                memcpy(pCopy, data, len);
+                data = pCopy;
+            }
+            insert(data, len, text, h);
+        }
+        
+        return -1;
     }
     
-    
-    double decodeDouble() 
-    {   
-        CborError err;
-        double value_buffer;
-        
-        err = cbor_value_get_double(&m_it, &value_buffer);
-        if (err != CborNoError)
-            throw DecoderException(err);
-        
-        next();
-        
-        return value_buffer;
+    /* decoder side, record a string without copying it */
+    void add(const uint8_t* data, size_t len, bool text)
+    {
+        if (len >= minLength(m_entries.size())) {
+            Entry entry = { data, len, text };
+            m_entries.push_back(entry);
+        }
     }
     
+    /* storage for strings that aren't contiguous in the input */
+    uint8_t* allocate(size_t len) { return m_arena.allocate<uint8_t>(len); }
     
-    template <typename T>
-    uint64_t decode(TUint<T>& value) 
-    {   
-        value.set(decodeUint());
-        return value.value;
-    }
-
-    template <typename T>
-    int64_t decode(TInt<T>& value) 
-    {   
-        value.set(decodeInt());
-        return value.value;
-    }
-
-    template <typename T>
-    std::string decode(TString<T>& value) 
-    {   
-        value.set(decodeString());
-        return value.value;
+    const Entry* get(uint64_t index) const 
+    { 
+        return index < m_entries.size() ? &m_entries[index] : nullptr; 
     }
     
-    std::vector<uint8_t> decode(TBytes< std::vector<uint8_t> >& value) 
-    {   
-        value.set(decodeBytes());
-        return value.value;
-    }
+    size_t size() const { return m_entries.size(); }
     
-    template <typename T>
-    bool decode(TBool<T>& value) 
-    {   
-        value.set(decodeBool());
-        return value.value;
+    /* forget the strings recorded after the first size ones, see Encoder::rollback() */
+    void truncate(size_t size)
+    {
+        if (size >= m_entries.size())
+            return;
+        
+        m_entries.resize(size);
+        std::fill(m_slots.begin(), m_slots.end(), -1);
+        for (size_t i = 0; i < m_entries.size(); ++i)
+            place(hashBytes(m_entries[i].data, m_entries[i].length, m_entries[i].text), 
+                    (int32_t)i);
     }
     
-    template <typename T>
-    float decode(TFloat<T>& value) 
-    {   
-        value.set(decodeFloat());
-        return value.value;
-    }
+private:
     
-    template <typename T>
-    double decode(TDouble<T>& value) 
-    {   
-        value.set(decodeDouble());
-        return value.value;
+    void insert(const uint8_t* data, size_t len, bool text, uint64_t h)
+    {
+        if (2 * (m_entries.size() + 1) > m_slots.size()) {
+            m_slots.assign(m_slots.empty() ? 32 : 2 * m_slots.size(), -1);
+            for (size_t i = 0; i < m_entries.size(); ++i)
+                place(hashBytes(m_entries[i].data, m_entries[i].length, m_entries[i].text), 
+                        (int32_t)i);
+        }
+        
+        Entry entry = { data, len, text };
+        m_entries.push_back(entry);
+        place(h, (int32_t)(m_entries.size() - 1));
     }
     
+    void place(uint64_t h, int32_t index)
+    {
+        size_t mask = m_slots.size() - 1;
+        size_t i = h & mask;
+        while (m_slots[i] >= 0)
+            i = (i + 1) & mask;
+        m_slots[i] = index;
+    }
     
-    bool isMap() { return cbor_value_is_map(&m_it); }
-    
-    bool isArray() { return cbor_value_is_array(&m_it); }
+    std::vector<Entry> m_entries;
+    std::vector<int32_t> m_slots;
+    Arena m_arena;
+};
+
+
+//-----------------------------------------------------------------------------
+// Scatter-Gather Output
+//-----------------------------------------------------------------------------
+
+/* output moved from pOld to pNew by Encoder::grow(), pEnd is the new end */
+struct Relocation
+{
+    const uint8_t* pOld;
+    uint8_t* pNew;
+    uint8_t* pEnd;
     
-    bool isString() { return cbor_value_is_text_string(&m_it); }
+    uint8_t* move(const uint8_t* p) const { return pNew + (p - pOld); }
+};
+
+
+//-----------------------------------------------------------------------------
+
+/**
+ * Byte strings of at least threshold bytes written as CBytesRef are left out 
+ * of the encoder buffer, only their header is encoded. The output is the 
+ * encoded buffer with the payloads spliced back in, see forEach().
+ */
+class GatherList
+{
+
+public:
     
-    bool isBytes() { return cbor_value_is_byte_string(&m_it); }
+    struct Segment
+    {
+        const uint8_t* data;
+        size_t length;
+    };
     
-    bool isInt() { return cbor_value_is_integer(&m_it); }
+    GatherList(size_t threshold = 1024) : m_threshold(threshold) { }
     
-    bool isUint() { return cbor_value_is_unsigned_integer(&m_it); }
+    /* forget the payloads of the previous message */
+    void clear() { m_splits.clear(); }
     
-    bool isBool() { return cbor_value_is_boolean(&m_it); }
+    size_t threshold() const { return m_threshold; }
     
-    bool isFloat() { return cbor_value_is_float(&m_it); }
+    /* payload to insert at pos of the encoder buffer */
+    void add(const uint8_t* pos, const uint8_t* data, size_t len)
+    {
+        Split split = { pos, { data, len } };
+        m_splits.push_back(split);
+    }
     
-    bool isDouble() { return cbor_value_is_double(&m_it); }
+    /* the encoder buffer was moved */
+    void relocate(const Relocation& to)
+    {
+        for (size_t i = 0; i < m_splits.size(); ++i)
+            m_splits[i].pos = to.move(m_splits[i].pos);
+    }
     
-    bool isUndefined() { return cbor_value_is_undefined(&m_it); }
+    /* move the payloads behind pFrom, used when a container header is rewritten */
+    void shift(const uint8_t* pFrom, ptrdiff_t delta)
+    {
+        for (size_t i = m_splits.size(); i-- > 0 && m_splits[i].pos > pFrom; )
+            m_splits[i].pos += delta;
+    }
     
-    bool isNull() { return cbor_value_is_null(&m_it); }
+    /* drop the payloads behind pos, the output was rolled back to it */
+    void truncate(const uint8_t* pos)
+    {
+        while (!m_splits.empty() && m_splits.back().pos > pos)
+            m_splits.pop_back();
+    }
     
-    size_t getArrayLength() 
-    { 
-        size_t len; 
-        CborError err = cbor_value_get_array_length(&m_it, &len);
-        if (err != CborNoError)
-            throw DecoderException(err);
-        return len;
+    /* call fn(data, length) for each piece of the output in order */
+    template <typename Fn>
+    void forEach(const uint8_t* pBegin, const uint8_t* pEnd, Fn fn) const
+    {
+        const uint8_t* p = pBegin;
+        
+        for (size_t i = 0; i < m_splits.size(); ++i) {
+            if (m_splits[i].pos > p)
+                fn(p, (size_t)(m_splits[i].pos - p));
+            fn(m_splits[i].payload.data, m_splits[i].payload.length);
+            p = m_splits[i].pos;
+        }
+        
+        if (pEnd > p)
+            fn(p, (size_t)(pEnd - p));
     }
     
-    size_t getMapLength() 
-    { 
-        size_t len; 
-        CborError err = cbor_value_get_map_length(&m_it, &len);
-        if (err != CborNoError)
-            throw DecoderException(err);
-        return len;
+    std::vector<Segment> segments(const uint8_t* pBegin, const uint8_t* pEnd) const
+    {
+        std::vector<Segment> out;
+        out.reserve(2 * m_splits.size() + 1);
+        forEach(pBegin, pEnd, [&out](const uint8_t* data, size_t len) {
+            Segment segment = { data, len };
+            out.push_back(segment);
+        });
+        
+        return out;
     }
     
-    void next() 
-    { 
-        CborError err = cbor_value_advance(&m_it);
-        if (err != CborNoError)
-            throw DecoderException(err);
+#if defined(__unix__) || defined(__APPLE__)
+    /* output for writev() or sendmsg() */
+    std::vector<struct iovec> iovecs(const uint8_t* pBegin, const uint8_t* pEnd) const
+    {
+        std::vector<struct iovec> out;
+        out.reserve(2 * m_splits.size() + 1);
+        forEach(pBegin, pEnd, [&out](const uint8_t* data, size_t len) {
+            struct iovec io;
+            io.iov_base = const_cast<uint8_t*>(data);
+            io.iov_len = len;
+            out.push_back(io);
+        });
+        
+        return out;
     }
-
-    CborValue& getIterator() { return m_it; }
+#endif
     
-protected:
-
-    CborValue& m_it;
-
+private:
+    
+    struct Split
+    {
+        const uint8_t* pos;
+        Segment payload;
+    };
+    
+    size_t m_threshold;
+    std::vector<Split> m_splits;
 };
 
 
+//-----------------------------------------------------------------------------
+// CBorEncoder
 //-----------------------------------------------------------------------------
 
-class DecoderBuffer : public Decoder
+class Encoder
 {
 
 public:
     
-    DecoderBuffer(uint8_t* pBuffer, size_t buffer_size) 
-        : Decoder(m_it), m_pBuffer(pBuffer)
-    { 
-        cbor_parser_init(pBuffer, buffer_size, 0, &m_parser, &m_it);
-    }
+    Encoder(CborEncoder& rEncoder) 
+        : m_rEncoder(rEncoder), m_floatEncoding(FloatExact), 
+          m_lengthEncoding(LengthIndefinite), m_pKeys(nullptr), m_pStringRefs(nullptr), 
+          m_pGather(nullptr), m_pArena(nullptr), m_chunkType(0), m_countOverflow(false) { }
 
-    virtual ~DecoderBuffer() { }    
+    virtual ~Encoder() { }
     
-private:
-    uint8_t* m_pBuffer;
-    CborParser m_parser;
-    CborValue m_it;
-};
-
-
-//-----------------------------------------------------------------------------
-
-class InnerDecoder : public Decoder
-{
-
-public:
+    Encoder& encode(const CUint& value) 
+    {   
+#if TINYCBORWRAPPER_NATIVE
+        if (writeItem(CborIntegerType, value.value))
+            return *this;
+#endif
+        ensure(9);
+        CborError err = cbor_encode_uint(&m_rEncoder, value.value);
+        check(err);
+        
+        return *this;
+    }
     
-    InnerDecoder(Decoder& rOuter) : Decoder(m_it), m_rOuter(rOuter) {
-        if (!cbor_value_is_container(&m_rOuter.getIterator()))
-            throw DecoderException(CborErrorUnknownType);
-        cbor_value_enter_container(&m_rOuter.getIterator(), &m_it);
+    Encoder& encode(const CInt& value) 
+    {   
+#if TINYCBORWRAPPER_NATIVE
+        uint64_t sign = (uint64_t)(value.value >> 63);
+        if (writeItem((uint8_t)(sign & 0x20), (uint64_t)value.value ^ sign))
+            return *this;
+#endif
+        ensure(9);
+        CborError err = cbor_encode_int(&m_rEncoder, value.value);
+        check(err);
+        
+        return *this;
     }
     
-    virtual ~InnerDecoder() {
-        cbor_value_leave_container(&m_rOuter.getIterator(), &m_it);
-    }    
+    Encoder& encode(const CString& value)
+    {
+        return encodeString(value.value.c_str(), value.value.length());
+    }
     
-    Decoder& getOuter() { return m_rOuter; }
+    Encoder& encode(const CBytes& value)
+    {
+        return encodeBytes(value.value.data(), value.value.size());
+    }
     
-private:
-
-    Decoder& m_rOuter;
-    CborValue m_it;
-};
-
+    Encoder& encode(const CBytesRef& value)
+    {
+        if (!m_pGather || value.size < m_pGather->threshold())
+            return encodeBytes(value.data, value.size);
+        
+        /* the payload outlives the output, the table keeps a view of it */
+        if (m_pStringRefs && encodeStringRef(value.data, value.size, false, false))
+            return *this;
+        
+        uint8_t head[9];
+        append(head, writeHead(head, CborByteStringType, value.size) - head);
+        countEncoderItems(m_rEncoder);
+        
+        if (encoderEnd(m_rEncoder))
+            m_pGather->add(encoderPosition(m_rEncoder), value.data, value.size);
+        return *this;
+    }
+    
+    /**
+     * Already encoded items, e.g. a ConstItem. Not inside a string reference 
+     * namespace, as the decoder would see strings missing in its table.
+     */
+    Encoder& encode(const CEncoded& value)
+    {
+        if (m_pStringRefs)
+            throw EncoderException(CborErrorUnsupportedType);
+        
+        append(value.data, value.size);
+        countEncoderItems(m_rEncoder, value.items);
+        
+        return *this;
+    }
+    
+    Encoder& encode(const CBool& value)
+    {
+#if TINYCBORWRAPPER_NATIVE
+        if (writeItem(CborSimpleType, value.value ? 21 : 20))
+            return *this;
+#endif
+        ensure(1);
+        CborError err = cbor_encode_boolean(&m_rEncoder, value.value);
+        check(err);
+        
+        return *this;
+    }
+    
+    Encoder& encode(const CFloat& value)
+    {
+        if (m_floatEncoding == FloatShortest && isHalfLossless(value.value))
+            return encode(CHalf(value.value));
+        
+#if TINYCBORWRAPPER_NATIVE
+        uint32_t bits;
+        memcpy(&bits, &value.value, sizeof(bits));
+        if (writeFixed(CborFloatType, bits))
+            return *this;
+#endif
+        ensure(5);
+        CborError err = cbor_encode_float(&m_rEncoder, value.value);
+        check(err);
+        
+        return *this;
+    }
 
-//-----------------------------------------------------------------------------
+    Encoder& encode(const CDouble& value)
+    {
+        float narrow = (float)value.value;
+        if (m_floatEncoding == FloatShortest 
+                && ((double)narrow == value.value || value.value != value.value))
+            return encode(CFloat(narrow));
+        
+#if TINYCBORWRAPPER_NATIVE
+        uint64_t bits;
+        memcpy(&bits, &value.value, sizeof(bits));
+        if (writeFixed(CborDoubleType, bits))
+            return *this;
+#endif
+        ensure(9);
+        CborError err = cbor_encode_double(&m_rEncoder, value.value);
+        check(err);
+        
+        return *this;
+    }
+    
+    Encoder& encode(const CHalf& value)
+    {
+        uint16_t half = floatToHalf(value.value);
+#if TINYCBORWRAPPER_NATIVE
+        if (writeFixed(CborHalfFloatType, half))
+            return *this;
+#endif
+        ensure(3);
+        CborError err = cbor_encode_half_float(&m_rEncoder, &half);
+        check(err);
+        
+        return *this;
+    }
+    
+    Encoder& encodeNull()
+    {
+#if TINYCBORWRAPPER_NATIVE
+        if (writeItem(CborSimpleType, 22))
+            return *this;
+#endif
+        ensure(1);
+        CborError err = cbor_encode_null(&m_rEncoder);
+        check(err);
+        
+        return *this;
+    }
 
-inline Decoder& leave(Decoder& container)
-{
-    if (InnerDecoder* s = dynamic_cast<InnerDecoder*>(&container)) {
-        Decoder& outer = s->getOuter();
-        delete s;
-        return outer;
+    Encoder& encodeUndefined()
+    {
+#if TINYCBORWRAPPER_NATIVE
+        if (writeItem(CborSimpleType, 23))
+            return *this;
+#endif
+        ensure(1);
+        CborError err = cbor_encode_undefined(&m_rEncoder);
+        check(err);
+        
+        return *this;
     }
 
-    return container;
+    Encoder& encodeString(const char* str, size_t len)
+    {
+        if (m_pStringRefs && encodeStringRef(reinterpret_cast<const uint8_t*>(str), len, true))
+            return *this;
+        
+#if TINYCBORWRAPPER_NATIVE
+        if (writeString(CborTextStringType, str, len))
+            return *this;
+#endif
+        ensure(9 + len);
+        CborError err = cbor_encode_text_string(&m_rEncoder, str, len);
+        check(err);
+        
+        return *this;
+    }
+    
+    Encoder& encodeBytes(const uint8_t* bytes, size_t len)
+    {
+        if (m_pStringRefs && encodeStringRef(bytes, len, false))
+            return *this;
+        
+#if TINYCBORWRAPPER_NATIVE
+        if (writeString(CborByteStringType, bytes, len))
+            return *this;
+#endif
+        ensure(9 + len);
+        CborError err = cbor_encode_byte_string(&m_rEncoder, bytes, len);
+        check(err);
+        
+        return *this;
+    }
+    
+    Encoder& encodeTag(CborTag tag)
+    {
+        ensure(9);
+        CborError err = cbor_encode_tag(&m_rEncoder, tag);
+        check(err);
+        
+        return *this;
+    }
+    
+    Encoder& encodeSimple(uint8_t value)
+    {
+        ensure(2);
+        CborError err = cbor_encode_simple_value(&m_rEncoder, value);
+        check(err);
+        
+        return *this;
+    }
+    
+    /**
+     * Open an indefinite length byte string for data that doesn't fit into 
+     * memory at once. The content is appended with writeChunk() and closed 
+     * with endChunks(), nothing else may be encoded in between. Not inside 
+     * a string reference namespace, the string couldn't be referenced.
+     */
+    Encoder& startChunkedBytes() { return startChunks(CborByteStringType); }
+    
+    /* as startChunkedBytes(), chunks must not split UTF-8 sequences */
+    Encoder& startChunkedString() { return startChunks(CborTextStringType); }
+    
+    /* append one definite length chunk, empty chunks are dropped */
+    Encoder& writeChunk(const void* data, size_t len)
+    {
+        if (!m_chunkType)
+            throw EncoderException(CborErrorIllegalType);
+        if (!len)
+            return *this;
+        
+        /* chunks larger than a streaming buffer are split */
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        size_t limit = maxChunk();
+        
+        while (len) {
+            size_t piece = std::min(len, limit);
+            uint8_t head[9];
+            append(head, writeHead(head, m_chunkType, piece) - head);
+            append(p, piece);
+            p += piece;
+            len -= piece;
+        }
+        return *this;
+    }
+    
+    Encoder& endChunks()
+    {
+        if (!m_chunkType)
+            throw EncoderException(CborErrorIllegalType);
+        
+        const uint8_t brk = 0xff;
+        m_chunkType = 0;
+        append(&brk, 1);
+        return *this;
+    }
+    
+    Encoder& encode(const CKey& key)
+    {
+        int64_t id = m_pKeys ? m_pKeys->find(key.value, key.length) : -1;
+        if (id >= 0)
+            return encode(CUint((uint64_t)id));
+        
+        return encodeString(key.value, key.length);
+    }
+    
+    /* tagged byte string in native byte order, written with one memcpy */
+    template <typename T>
+    Encoder& encode(const CTypedArray<T>& value)
+    {
+        encodeTag(typedArrayTag<T>());
+        return encodeBytes(reinterpret_cast<const uint8_t*>(value.data), value.size * sizeof(T));
+    }
+
+    /**
+     * Encode count numbers as one definite length array. If the buffer can 
+     * take the worst case size, all items are written in a single pass 
+     * without going through tinycbor per item.
+     */
+    template <typename T>
+    Encoder& encodeNumbers(const T* values, size_t count)
+    {
+        static_assert(IsNumber<T>::value, "integer or floating point type expected");
+        
+        const size_t item_size = std::is_floating_point<T>::value 
+                ? 1 + sizeof(T) : (sizeof(T) == 1 ? 2 : 1 + sizeof(T));
+        
+        uint8_t* p = nullptr;
+        if (count <= (SIZE_MAX - 9) / item_size)
+            p = reserve(9 + count * item_size);
+        
+        if (!p) {
+            bool shortest = m_floatEncoding == FloatShortest;
+            CborEncoder inner;
+            CborError err = cbor_encoder_create_array(&m_rEncoder, &inner, count);
+            for (size_t i = 0; i < count && (err == CborNoError || err == CborErrorOutOfMemory); ++i)
+                err = encodeNumber(&inner, values[i], shortest);
+            CborError close_err = cbor_encoder_close_container(&m_rEncoder, &inner);
+            check(err != CborNoError ? err : close_err);
+            
+            return *this;
+        }
+        
+        p = writeHead(p, CborArrayType, count);
+        if (m_floatEncoding == FloatShortest)
+            p = writeShortest(p, values, count);
+        else
+            p = writeNumbers(p, values, count);
+        commit(p);
+        
+        return *this;
+    }
+    
+    /* applies to this and all containers opened from it afterwards */
+    void setFloatEncoding(FloatEncoding encoding) { m_floatEncoding = encoding; }
+    
+    FloatEncoding getFloatEncoding() { return m_floatEncoding; }
+    
+    void setLengthEncoding(LengthEncoding encoding) { m_lengthEncoding = encoding; }
+    
+    LengthEncoding getLengthEncoding() { return m_lengthEncoding; }
+    
+    /* containers opened from this one afterwards are allocated in the arena */
+    void setArena(Arena* pArena) { m_pArena = pArena; }
+    
+    Arena* getArena() { return m_pArena; }
+    
+    /* applies to this and all containers opened from it afterwards, 
+     * the dictionary has to outlive the encoder */
+    void setKeyDictionary(const KeyDictionary* pKeys) { m_pKeys = pKeys; }
+    
+    const KeyDictionary* getKeyDictionary() { return m_pKeys; }
+    
+    /* strings repeated within this and all containers opened from it 
+     * afterwards are written as references, see startStringRefArray() */
+    void setStringRefs(StringRefTable* pStringRefs) { m_pStringRefs = pStringRefs; }
+    
+    StringRefTable* getStringRefs() { return m_pStringRefs; }
+    
+    /* applies to this and all containers opened from it afterwards */
+    void setGatherList(GatherList* pGather) { m_pGather = pGather; }
+    
+    GatherList* getGatherList() { return m_pGather; }
+    
+    /**
+     * Keep encoding into the void when the buffer is full, tinycbor counts 
+     * the missing bytes (cbor_encoder_get_extra_bytes_needed). Otherwise an 
+     * EncoderException(CborErrorOutOfMemory) is thrown.
+     */
+    void setCountOverflow(bool count) { m_countOverflow = count; }
+    
+    bool getCountOverflow() { return m_countOverflow; }
+    
+    /* throws for err, except for overflows that are counted */
+    void check(CborError err)
+    {
+        if (err != CborNoError && !(err == CborErrorOutOfMemory && m_countOverflow))
+            throw EncoderException(err);
+    }
+    
+    /**
+     * Make room for len more bytes if the output can grow, see 
+     * InlineEncoderBuffer. Call it before writing to getEncoder() directly.
+     */
+    void ensure(size_t len)
+    {
+        if (encoderEnd(m_rEncoder) && encoderRoom(m_rEncoder) < len) {
+            Relocation to;
+            grow(encoderPosition(m_rEncoder), len, to);
+        }
+    }
+    
+    /* state of the encoder at mark(), see rollback() */
+    struct Checkpoint
+    {
+        CborEncoder state;
+        size_t offset;
+        uint64_t flushed;
+        size_t stringRefs;
+        uint8_t chunkType;
+    };
+    
+    Checkpoint mark()
+    {
+        uint8_t* pBegin;
+        uint8_t* pEnd;
+        
+        Checkpoint cp;
+        cp.state = m_rEncoder;
+        cp.offset = encoderEnd(m_rEncoder) && output(pBegin, pEnd) 
+                ? encoderPosition(m_rEncoder) - pBegin : 0;
+        cp.flushed = flushed();
+        cp.stringRefs = m_pStringRefs ? m_pStringRefs->size() : 0;
+        cp.chunkType = m_chunkType;
+        return cp;
+    }
+    
+    /**
+     * Drop everything encoded since cp was taken from this encoder, also 
+     * after an overflow or a growing buffer moved. Containers opened since 
+     * then must not be used anymore. Throws CborErrorUnsupportedType if an 
+     * EncoderStream passed output behind cp on to its sink.
+     */
+    void rollback(const Checkpoint& cp)
+    {
+        uint8_t* pBegin;
+        uint8_t* pEnd;
+        
+        uint64_t done = flushed();
+        if (cp.flushed + cp.offset < done)
+            throw EncoderException(CborErrorUnsupportedType);
+        
+        m_rEncoder = cp.state;
+        if (encoderEnd(m_rEncoder) && output(pBegin, pEnd)) {
+            setEncoderPosition(m_rEncoder, pBegin + (size_t)(cp.flushed + cp.offset - done));
+            setEncoderEnd(m_rEncoder, pEnd);
+        }
+        
+        m_chunkType = cp.chunkType;
+        if (m_pStringRefs)
+            m_pStringRefs->truncate(cp.stringRefs);
+        
+        if (encoderEnd(m_rEncoder)) {
+            if (m_pGather)
+                m_pGather->truncate(encoderPosition(m_rEncoder));
+            truncate(encoderPosition(m_rEncoder));
+        }
+    }
+    
+    CborEncoder& getEncoder() { return m_rEncoder; }
+    
+    
+protected:
+    
+    /**
+     * Buffers that can grow move the output written up to pUsed into memory 
+     * with room for len more bytes, every open container relocates its 
+     * pointers on the way back. Returns false if the output is fixed.
+     */
+    virtual bool grow(const uint8_t* pUsed, size_t len, Relocation& to)
+    {
+        (void)pUsed;
+        (void)len;
+        (void)to;
+        return false;
+    }
+    
+    /**
+     * The output from pFrom on moved by delta bytes, as a container got its 
+     * definite length. Encoders keeping positions into the output override it.
+     */
+    virtual void shift(const uint8_t* pFrom, ptrdiff_t delta)
+    {
+        (void)pFrom;
+        (void)delta;
+    }
+    
+    /**
+     * The whole output buffer of the message, false if it isn't known. 
+     * Lets rollback() find its position after the buffer moved.
+     */
+    virtual bool output(uint8_t*& pBegin, uint8_t*& pEnd)
+    {
+        (void)pBegin;
+        (void)pEnd;
+        return false;
+    }
+    
+    /* the output behind pEnd was rolled back */
+    virtual void truncate(const uint8_t* pEnd)
+    {
+        (void)pEnd;
+    }
+    
+    /* largest chunk writeChunk() emits, see EncoderStream */
+    virtual size_t maxChunk() { return SIZE_MAX; }
+    
+    /* output passed on in front of the output buffer, see EncoderStream */
+    virtual uint64_t flushed() { return 0; }
+    
+    void relocate(const Relocation& to)
+    {
+        /* the position of a container with an open child is stale, an 
+         * EncoderStream may have passed it on already */
+        uint8_t* p = encoderPosition(m_rEncoder);
+        setEncoderPosition(m_rEncoder, p < to.pOld ? to.pNew : to.move(p));
+        setEncoderEnd(m_rEncoder, to.pEnd);
+    }
+    
+    bool encodeStringRef(const uint8_t* data, size_t len, bool text, bool copy = true)
+    {
+        int64_t index = m_pStringRefs->reference(data, len, text, copy);
+        if (index < 0)
+            return false;
+        
+        encodeTag(TagStringRef);
+        encode(CUint((uint64_t)index));
+        return true;
+    }
+    
+    Encoder& startChunks(uint8_t type)
+    {
+        if (m_chunkType)
+            throw EncoderException(CborErrorIllegalType);
+        if (m_pStringRefs)
+            throw EncoderException(CborErrorUnsupportedType);
+        
+        const uint8_t head = type | 31;
+        append(&head, 1);
+        m_chunkType = type;
+        
+        /* the whole string is one item of the container */
+        countEncoderItems(m_rEncoder);
+        return *this;
+    }
+    
+    /* raw bytes that aren't an item, overflow is accounted like tinycbor does */
+    void append(const void* data, size_t len)
+    {
+        if (!encoderEnd(m_rEncoder)) {
+            overflowEncoder(m_rEncoder, len);
+            return check(CborErrorOutOfMemory);
+        }
+        
+        ensure(len);
+        
+        size_t room = encoderRoom(m_rEncoder);
+        if (room < len) {
+            overflowEncoder(m_rEncoder, len - room);
+            return check(CborErrorOutOfMemory);
+        }
+        
+        uint8_t* p = encoderPosition(m_rEncoder);
+        memcpy(p, data, len);
+        setEncoderPosition(m_rEncoder, p + len);
+    }
+    
+    /**
+     * Direct access to the output for writing one item of up to len bytes, 
+     * nullptr if the buffer can't take len more bytes.
+     */
+    uint8_t* reserve(size_t len)
+    {
+        ensure(len);
+        
+        if (!encoderEnd(m_rEncoder) || encoderRoom(m_rEncoder) < len)
+            return nullptr;
+        
+        return encoderPosition(m_rEncoder);
+    }
+    
+    /* finish an item written through reserve(), pEnd is one past its end */
+    void commit(uint8_t* pEnd)
+    {
+        setEncoderPosition(m_rEncoder, pEnd);
+        countEncoderItems(m_rEncoder);
+    }
+    
+#if TINYCBORWRAPPER_NATIVE
+    /* inline writes of one item, false leaves full buffers and counting 
+     * to tinycbor */
+    bool writeItem(uint8_t major, uint64_t value)
+    {
+        uint8_t* p = reserve(9);
+        if (!p)
+            return false;
+        
+        commit(writeHead(p, major, value));
+        return true;
+    }
+    
+    template <typename T>
+    bool writeFixed(uint8_t initial, T bits)
+    {
+        uint8_t* p = reserve(1 + sizeof(T));
+        if (!p)
+            return false;
+        
+        p[0] = initial;
+        storeBigEndian(p + 1, bits);
+        commit(p + 1 + sizeof(T));
+        return true;
+    }
+    
+    bool writeString(uint8_t major, const void* data, size_t len)
+    {
+        uint8_t* p = len < SIZE_MAX - 9 ? reserve(9 + len) : nullptr;
+        if (!p)
+            return false;
+        
+        p = writeHead(p, major, len);
+        memcpy(p, data, len);
+        commit(p + len);
+        return true;
+    }
+#endif
+    
+    /* narrowed like encode(CFloat) and encode(CDouble) if shortest */
+    static CborError encodeNumber(CborEncoder* pEncoder, float value, bool shortest) 
+    { 
+        if (shortest && isHalfLossless(value)) {
+            uint16_t half = floatToHalf(value);
+            return cbor_encode_half_float(pEncoder, &half);
+        }
+        return cbor_encode_float(pEncoder, value); 
+    }
+    
+    static CborError encodeNumber(CborEncoder* pEncoder, double value, bool shortest) 
+    { 
+        float narrow = (float)value;
+        if (shortest && ((double)narrow == value || value != value))
+            return encodeNumber(pEncoder, narrow, true);
+        return cbor_encode_double(pEncoder, value); 
+    }
+    
+    template <typename T>
+    static CborError encodeNumber(CborEncoder* pEncoder, T value, bool)
+    {
+        return std::is_signed<T>::value 
+                ? cbor_encode_int(pEncoder, (int64_t)value) 
+                : cbor_encode_uint(pEncoder, (uint64_t)value);
+    }
+    
+    static uint8_t* writeNumbers(uint8_t* p, const float* values, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i, p += 5) {
+            uint32_t bits;
+            memcpy(&bits, &values[i], sizeof(bits));
+            p[0] = CborFloatType;
+            storeBigEndian(p + 1, bits);
+        }
+        return p;
+    }
+    
+    static uint8_t* writeNumbers(uint8_t* p, const double* values, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i, p += 9) {
+            uint64_t bits;
+            memcpy(&bits, &values[i], sizeof(bits));
+            p[0] = CborDoubleType;
+            storeBigEndian(p + 1, bits);
+        }
+        return p;
+    }
+    
+    template <typename T>
+    static uint8_t* writeNumbers(uint8_t* p, const T* values, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i) {
+            /* negative n is encoded as -1 - n, which is ~n */
+            uint64_t v = (uint64_t)(int64_t)values[i];
+            uint64_t sign = std::is_signed<T>::value ? (uint64_t)((int64_t)v >> 63) : 0;
+            p = writeHead(p, (uint8_t)(sign & 0x20), v ^ sign);
+        }
+        return p;
+    }
+    
+    template <typename T>
+    static uint8_t* writeShortest(uint8_t* p, const T* values, size_t count)
+    {
+        return writeNumbers(p, values, count);
+    }
+    
+    /* round trips blocks through the batch converters to find the floats
+     * which survive as half precision */
+    static uint8_t* writeShortest(uint8_t* p, const float* values, size_t count)
+    {
+        const size_t block = 64;
+        uint16_t halfs[block];
+        float back[block];
+        
+        for (size_t i = 0; i < count; i += block) {
+            size_t n = std::min(block, count - i);
+            floatsToHalfs(values + i, halfs, n);
+            halfsToFloats(halfs, back, n);
+            
+            for (size_t j = 0; j < n; ++j) {
+                if (back[j] == values[i + j] || values[i + j] != values[i + j]) {
+                    p[0] = CborHalfFloatType;
+                    storeBigEndian(p + 1, halfs[j]);
+                    p += 3;
+                } else {
+                    p = writeNumbers(p, values + i + j, 1);
+                }
+            }
+        }
+        return p;
+    }
+    
+    static uint8_t* writeShortest(uint8_t* p, const double* values, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i) {
+            float narrow = (float)values[i];
+            if ((double)narrow == values[i] || values[i] != values[i])
+                p = writeShortest(p, &narrow, 1);
+            else
+                p = writeNumbers(p, values + i, 1);
+        }
+        return p;
+    }
+
+    CborEncoder& m_rEncoder;
+    FloatEncoding m_floatEncoding;
+    LengthEncoding m_lengthEncoding;
+    const KeyDictionary* m_pKeys;
+    StringRefTable* m_pStringRefs;
+    GatherList* m_pGather;
+    Arena* m_pArena;
+    uint8_t m_chunkType;
+    bool m_countOverflow;
+    friend Encoder& operator<<(Encoder&, tEncoderFn);
+    friend Encoder& createArray(Encoder& container, size_t size);
+    friend Encoder& createMap(Encoder& container, size_t size);
+    friend class InnerEncoder;
+    friend class MessageTemplate;
+};
+
+
+//-----------------------------------------------------------------------------
+
+class EncoderBuffer : public Encoder
+{
+
+public:
+    
+    EncoderBuffer(size_t buffer_size = 4096) 
+        : Encoder(m_rEncoder), m_pBuffer(new uint8_t[buffer_size]), m_bufferSize(buffer_size)
+    {
+        cbor_encoder_init(&m_rEncoder, m_pBuffer, buffer_size, 0);
+    }
+
+    virtual ~EncoderBuffer() { delete[] m_pBuffer; }
+
+    /* rewind for the next message, the settings are kept */
+    void reset() { cbor_encoder_init(&m_rEncoder, m_pBuffer, m_bufferSize, 0); }
+    
+    size_t size() {
+        return cbor_encoder_get_buffer_size(&m_rEncoder, m_pBuffer);
+    }
+    
+    uint8_t* getBuffer() { return m_pBuffer; }
+    
+    size_t getBufferSize() { return m_bufferSize; }
+    
+protected:
+    
+    virtual bool output(uint8_t*& pBegin, uint8_t*& pEnd)
+    {
+        pBegin = m_pBuffer;
+        pEnd = m_pBuffer + m_bufferSize;
+        return true;
+    }
+    
+private:
+
+    CborEncoder m_rEncoder;
+    uint8_t* m_pBuffer;
+    size_t m_bufferSize;
+};
+
+
+//-----------------------------------------------------------------------------
+
+/**
+ * Encoder writing into memory owned by the caller, e.g. a DMA buffer or a 
+ * ring slot. An overflow doesn't throw, the encoding continues to find out 
+ * how many more bytes the message needs.
+ */
+class EncoderSpan : public Encoder
+{
+
+public:
+    
+    EncoderSpan(uint8_t* pBuffer, size_t buffer_size) : Encoder(m_rEncoder)
+    {
+        setCountOverflow(true);
+        reset(pBuffer, buffer_size);
+    }
+    
+    /* start a new message in the same or another buffer */
+    void reset(uint8_t* pBuffer, size_t buffer_size)
+    {
+        m_pBuffer = pBuffer;
+        m_bufferSize = buffer_size;
+        cbor_encoder_init(&m_rEncoder, pBuffer, buffer_size, 0);
+    }
+    
+    void reset() { reset(m_pBuffer, m_bufferSize); }
+    
+    /* bytes written, only valid without overflow */
+    size_t size() {
+        return cbor_encoder_get_buffer_size(&m_rEncoder, m_pBuffer);
+    }
+    
+    bool overflowed() { return !encoderEnd(m_rEncoder); }
+    
+    /* getBufferSize() + bytesNeeded() fits the whole message */
+    size_t bytesNeeded() { return cbor_encoder_get_extra_bytes_needed(&m_rEncoder); }
+    
+    uint8_t* getBuffer() { return m_pBuffer; }
+    
+    size_t getBufferSize() { return m_bufferSize; }
+    
+protected:
+    
+    virtual bool output(uint8_t*& pBegin, uint8_t*& pEnd)
+    {
+        pBegin = m_pBuffer;
+        pEnd = m_pBuffer + m_bufferSize;
+        return true;
+    }
+    
+private:
+
+    CborEncoder m_rEncoder;
+    uint8_t* m_pBuffer;
+    size_t m_bufferSize;
+};
+
+
+//-----------------------------------------------------------------------------
+
+/**
+ * Encoder with N bytes of inline storage, e.g. on the stack. Longer messages 
+ * move to the heap, the capacity at least doubles each time.
+ */
+template <size_t N>
+class InlineEncoderBuffer : public Encoder
+{
+
+public:
+    
+    InlineEncoderBuffer() 
+        : Encoder(m_rEncoder), m_pBuffer(m_inline), m_bufferSize(N), m_pRetired(nullptr)
+    {
+        cbor_encoder_init(&m_rEncoder, m_pBuffer, N, 0);
+    }
+    
+    virtual ~InlineEncoderBuffer() 
+    { 
+        release(m_pBuffer);
+        release(m_pRetired);
+    }
+    
+    /* rewind for the next message, a heap buffer is kept */
+    void reset()
+    {
+        release(m_pRetired);
+        m_pRetired = nullptr;
+        cbor_encoder_init(&m_rEncoder, m_pBuffer, m_bufferSize, 0);
+    }
+    
+    size_t size() {
+        return cbor_encoder_get_buffer_size(&m_rEncoder, m_pBuffer);
+    }
+    
+    uint8_t* getBuffer() { return m_pBuffer; }
+    
+    size_t getBufferSize() { return m_bufferSize; }
+    
+    bool isInline() { return m_pBuffer == m_inline; }
+    
+protected:
+    
+    virtual bool output(uint8_t*& pBegin, uint8_t*& pEnd)
+    {
+        pBegin = m_pBuffer;
+        pEnd = m_pBuffer + m_bufferSize;
+        return true;
+    }
+    
+    virtual bool grow(const uint8_t* pUsed, size_t len, Relocation& to)
+    {
+        size_t used = pUsed - m_pBuffer;
+        if (len > std::numeric_limits<size_t>::max() / 2 - used)
+            return false;
+        
+        size_t capacity = std::max(2 * m_bufferSize, used + len);
+        uint8_t* pBuffer = new uint8_t[capacity];
+        memcpy(pBuffer, m_pBuffer, used);
+        
+        to.pOld = m_pBuffer;
+        to.pNew = pBuffer;
+        to.pEnd = pBuffer + capacity;
+        relocate(to);
+        if (getGatherList())
+            getGatherList()->relocate(to);
+        
+        /* open containers still point into the old buffer until they relocated */
+        release(m_pRetired);
+        m_pRetired = m_pBuffer;
+        m_pBuffer = pBuffer;
+        m_bufferSize = capacity;
+        return true;
+    }
+    
+private:
+    
+    void release(uint8_t* pBuffer)
+    {
+        if (pBuffer != m_inline)
+            delete[] pBuffer;
+    }
+    
+    CborEncoder m_rEncoder;
+    uint8_t* m_pBuffer;
+    size_t m_bufferSize;
+    uint8_t* m_pRetired;
+    uint8_t m_inline[N];
+};
+
+
+//-----------------------------------------------------------------------------
+
+/**
+ * Encoder with a buffer from a BufferPool, sized by what the pool learned 
+ * about messages of the given type. Grows on demand, the size of each 
+ * message is recorded on reset() and the buffer goes back to the pool on 
+ * destruction. 
+ * 
+ * BufferPool isn't thread safe: with the default local() pool, a buffer 
+ * used or destroyed on another thread than the one that created it takes 
+ * memory from the heap and frees it there instead. An explicit pool must 
+ * only be used by one thread at a time and has to outlive the buffer.
+ */
+class PooledEncoderBuffer : public Encoder
+{
+
+public:
+    
+    PooledEncoderBuffer(uint32_t type = 0, BufferPool& pool = BufferPool::local()) 
+        : Encoder(m_rEncoder), m_rPool(pool), m_local(&pool == &BufferPool::local()), 
+          m_type(type), m_pRetired(nullptr)
+    {
+        size_t expected = pool.expected(type);
+        m_pBuffer = pool.acquire(expected ? expected : 1, m_bufferSize);
+        cbor_encoder_init(&m_rEncoder, m_pBuffer, m_bufferSize, 0);
+    }
+    
+    virtual ~PooledEncoderBuffer()
+    {
+        finish();
+        release(m_pBuffer, m_bufferSize);
+    }
+    
+    /* rewind for the next message of the same type, the buffer is kept */
+    void reset()
+    {
+        finish();
+        cbor_encoder_init(&m_rEncoder, m_pBuffer, m_bufferSize, 0);
+    }
+    
+    size_t size() {
+        return cbor_encoder_get_buffer_size(&m_rEncoder, m_pBuffer);
+    }
+    
+    uint8_t* getBuffer() { return m_pBuffer; }
+    
+    size_t getBufferSize() { return m_bufferSize; }
+    
+protected:
+    
+    virtual bool output(uint8_t*& pBegin, uint8_t*& pEnd)
+    {
+        pBegin = m_pBuffer;
+        pEnd = m_pBuffer + m_bufferSize;
+        return true;
+    }
+    
+    virtual bool grow(const uint8_t* pUsed, size_t len, Relocation& to)
+    {
+        size_t used = pUsed - m_pBuffer;
+        if (len > std::numeric_limits<size_t>::max() / 2 - used)
+            return false;
+        
+        size_t capacity = std::max(2 * m_bufferSize, used + len);
+        uint8_t* pBuffer = poolReachable() 
+                ? m_rPool.acquire(capacity, capacity) : new uint8_t[capacity];
+        memcpy(pBuffer, m_pBuffer, used);
+        
+        to.pOld = m_pBuffer;
+        to.pNew = pBuffer;
+        to.pEnd = pBuffer + capacity;
+        relocate(to);
+        if (getGatherList())
+            getGatherList()->relocate(to);
+        
+        /* open containers still point into the old buffer until they relocated */
+        retire();
+        m_pRetired = m_pBuffer;
+        m_retiredSize = m_bufferSize;
+        m_pBuffer = pBuffer;
+        m_bufferSize = capacity;
+        return true;
+    }
+    
+private:
+    
+    /* false on a foreign thread, the local() pool of the creating thread 
+     * may be in use there or already be gone */
+    bool poolReachable() { return !m_local || &BufferPool::local() == &m_rPool; }
+    
+    void release(uint8_t* pBuffer, size_t capacity)
+    {
+        if (poolReachable())
+            m_rPool.release(pBuffer, capacity);
+        else
+            delete[] pBuffer;
+    }
+    
+    void retire()
+    {
+        if (m_pRetired)
+            release(m_pRetired, m_retiredSize);
+        m_pRetired = nullptr;
+    }
+    
+    void finish()
+    {
+        retire();
+        if (encoderEnd(m_rEncoder) && size() && poolReachable())
+            m_rPool.record(m_type, size());
+    }
+    
+    CborEncoder m_rEncoder;
+    BufferPool& m_rPool;
+    bool m_local;
+    uint32_t m_type;
+    uint8_t* m_pBuffer;
+    size_t m_bufferSize;
+    uint8_t* m_pRetired;
+    size_t m_retiredSize;
+};
+
+
+//-----------------------------------------------------------------------------
+
+/**
+ * Encoder for output larger than memory, e.g. a chunked string of a file. 
+ * A full buffer is passed to the sink and reused, writeChunk() splits 
+ * chunks that don't fit. Every other item has to fit into the buffer.
+ * 
+ *   EncoderStream out(65536, [&](const uint8_t* data, size_t len) {
+ *       fwrite(data, 1, len, file);
+ *   });
+ *   out.startChunkedBytes();
+ *   while ((len = fread(block, 1, sizeof(block), input)) > 0)
+ *       out.writeChunk(block, len);
+ *   out.endChunks();
+ *   out.flush();
+ * 
+ * Output that was passed on can't be changed anymore: containers that are 
+ * made definite with LengthDefinite, a GatherList and rollback() only work 
+ * within the buffer and throw CborErrorUnsupportedType otherwise.
+ */
+class EncoderStream : public Encoder
+{
+
+public:
+    
+    typedef std::function<void(const uint8_t* data, size_t len)> tStreamSink;
+    
+    EncoderStream(size_t buffer_size, tStreamSink sink) 
+        : Encoder(m_rEncoder), m_pBuffer(new uint8_t[std::max<size_t>(buffer_size, 16)]), 
+          m_bufferSize(std::max<size_t>(buffer_size, 16)), m_sink(sink), m_written(0)
+    {
+        cbor_encoder_init(&m_rEncoder, m_pBuffer, m_bufferSize, 0);
+    }
+    
+    virtual ~EncoderStream() { delete[] m_pBuffer; }
+    
+    /* pass the buffered output to the sink, only with all containers closed */
+    void flush()
+    {
+        Relocation to;
+        if (encoderEnd(m_rEncoder))
+            grow(encoderPosition(m_rEncoder), 0, to);
+    }
+    
+    /* bytes in the buffer that weren't passed on yet */
+    size_t size() {
+        return cbor_encoder_get_buffer_size(&m_rEncoder, m_pBuffer);
+    }
+    
+    /* bytes passed to the sink */
+    uint64_t written() { return m_written; }
+    
+protected:
+    
+    virtual bool grow(const uint8_t* pUsed, size_t len, Relocation& to)
+    {
+        if (len > m_bufferSize)
+            return false;
+        if (getGatherList())
+            throw EncoderException(CborErrorUnsupportedType);
+        
+        size_t used = pUsed - m_pBuffer;
+        if (used)
+            m_sink(m_pBuffer, used);
+        m_written += used;
+        
+        to.pOld = pUsed;
+        to.pNew = m_pBuffer;
+        to.pEnd = m_pBuffer + m_bufferSize;
+        relocate(to);
+        return true;
+    }
+    
+    virtual bool output(uint8_t*& pBegin, uint8_t*& pEnd)
+    {
+        pBegin = m_pBuffer;
+        pEnd = m_pBuffer + m_bufferSize;
+        return true;
+    }
+    
+    virtual size_t maxChunk() { return m_bufferSize - 9; }
+    
+    virtual uint64_t flushed() { return m_written; }
+    
+private:
+    
+    CborEncoder m_rEncoder;
+    uint8_t* m_pBuffer;
+    size_t m_bufferSize;
+    tStreamSink m_sink;
+    uint64_t m_written;
+};
+
+
+//-----------------------------------------------------------------------------
+
+/* fixed width encodings of MessageTemplate slots */
+enum SlotType
+{
+    SlotUint32,
+    SlotUint64,
+    SlotInt32,
+    SlotInt64,
+    SlotFloat,
+    SlotDouble
+};
+
+
+//-----------------------------------------------------------------------------
+
+/**
+ * Message encoded once with fixed width placeholders for the values that 
+ * change per send, set() then overwrites them in the buffer:
+ * 
+ *   MessageTemplate msg(256);
+ *   msg << startMap(2) << "ts" << msg.slot("ts", SlotUint64) 
+ *           << "temp" << msg.slot("temp", SlotFloat) << end;
+ *   
+ *   msg.set("ts", now);
+ *   send(msg.getBuffer(), msg.size());
+ * 
+ * Slots are bound by name or by handle, the number of slots before them.
+ */
+class MessageTemplate : public EncoderBuffer
+{
+
+public:
+    
+    MessageTemplate(size_t buffer_size = 4096) : EncoderBuffer(buffer_size) { }
+    
+    /* placeholder encoded as zero, in this or a container of this message */
+    tEncoderFn slot(const std::string& name, SlotType type)
+    {
+        return std::bind(&MessageTemplate::writeSlot, this, std::placeholders::_1, name, type);
+    }
+    
+    /* SIZE_MAX if there is no slot of that name */
+    size_t handle(const std::string& name) const
+    {
+        for (size_t i = 0; i < m_slots.size(); ++i) {
+            if (m_slots[i].name == name)
+                return i;
+        }
+        
+        return SIZE_MAX;
+    }
+    
+    size_t slots() const { return m_slots.size(); }
+    
+    /* converts value to the slot type, throws CborErrorDataTooLarge if it 
+     * is out of the range of the slot type, e.g. 2^31 for SlotInt32 */
+    template <typename T>
+    void set(size_t handle, T value)
+    {
+        static_assert(std::is_arithmetic<T>::value && !std::is_same<T, bool>::value, 
+                "integer or floating point type expected");
+        
+        if (handle >= m_slots.size())
+            throw EncoderException(CborErrorImproperValue);
+        
+        const Slot& slot = m_slots[handle];
+        uint8_t* p = getBuffer() + slot.offset;
+        
+        if (std::is_floating_point<T>::value || slot.type >= SlotFloat)
+            writeReal(p, slot.type, (double)value);
+        else if (std::is_signed<T>::value && (int64_t)value < 0)
+            writeNegative(p, slot.type, (int64_t)value);
+        else
+            writeUnsigned(p, slot.type, (uint64_t)value);
+    }
+    
+    template <typename T>
+    void set(const std::string& name, T value) { set(handle(name), value); }
+    
+    /* rewind for a new template, the slots are dropped */
+    void reset()
+    {
+        EncoderBuffer::reset();
+        m_slots.clear();
+    }
+    
+private:
+    
+    struct Slot
+    {
+        std::string name;
+        size_t offset;
+        SlotType type;
+    };
+    
+    Encoder& writeSlot(Encoder& container, const std::string& name, SlotType type)
+    {
+        size_t width = type == SlotUint32 || type == SlotInt32 || type == SlotFloat ? 4 : 8;
+        
+        uint8_t* p = container.reserve(1 + width);
+        if (!p)
+            throw EncoderException(CborErrorOutOfMemory);
+        if (p < getBuffer() || p >= getBuffer() + getBufferSize())
+            throw EncoderException(CborErrorImproperValue);
+        
+        Slot slot = { name, (size_t)(p - getBuffer()), type };
+        m_slots.push_back(slot);
+        
+        if (type >= SlotFloat)
+            writeReal(p, type, 0);
+        else
+            writeUnsigned(p, type, 0);
+        
+        container.commit(p + 1 + width);
+        return container;
+    }
+    
+    static void writeUnsigned(uint8_t* p, SlotType type, uint64_t value)
+    {
+        uint64_t max = type == SlotUint64 ? std::numeric_limits<uint64_t>::max()
+                : type == SlotInt64 ? (uint64_t)std::numeric_limits<int64_t>::max()
+                : type == SlotUint32 ? std::numeric_limits<uint32_t>::max()
+                : (uint64_t)std::numeric_limits<int32_t>::max();
+        if (value > max)
+            throw EncoderException(CborErrorDataTooLarge);
+        
+        if (type == SlotUint64 || type == SlotInt64) {
+            p[0] = CborIntegerType | 27;
+            storeBigEndian(p + 1, value);
+            return;
+        }
+        
+        p[0] = CborIntegerType | 26;
+        storeBigEndian(p + 1, (uint32_t)value);
+    }
+    
+    static void writeNegative(uint8_t* p, SlotType type, int64_t value)
+    {
+        uint64_t magnitude = ~(uint64_t)value;
+        
+        if (type == SlotInt64) {
+            p[0] = 0x20 | 27;
+            storeBigEndian(p + 1, magnitude);
+            return;
+        }
+        
+        if (type != SlotInt32 || magnitude > (uint64_t)std::numeric_limits<int32_t>::max())
+            throw EncoderException(CborErrorDataTooLarge);
+        
+        p[0] = 0x20 | 26;
+        storeBigEndian(p + 1, (uint32_t)magnitude);
+    }
+    
+    static void writeReal(uint8_t* p, SlotType type, double value)
+    {
+        if (type == SlotDouble) {
+            uint64_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            p[0] = CborDoubleType;
+            storeBigEndian(p + 1, bits);
+            return;
+        }
+        
+        if (type != SlotFloat)
+            throw EncoderException(CborErrorIllegalType);
+        
+        /* narrowing a finite value beyond the float range is undefined */
+        const double max = std::numeric_limits<float>::max();
+        const double inf = std::numeric_limits<double>::infinity();
+        if ((value > max && value != inf) || (value < -max && value != -inf))
+            throw EncoderException(CborErrorDataTooLarge);
+        
+        float narrow = (float)value;
+        uint32_t bits;
+        memcpy(&bits, &narrow, sizeof(bits));
+        p[0] = CborFloatType;
+        storeBigEndian(p + 1, bits);
+    }
+    
+    virtual void shift(const uint8_t* pFrom, ptrdiff_t delta)
+    {
+        for (size_t i = 0; i < m_slots.size(); ++i) {
+            if (getBuffer() + m_slots[i].offset >= pFrom)
+                m_slots[i].offset += delta;
+        }
+    }
+    
+    virtual void truncate(const uint8_t* pEnd)
+    {
+        while (!m_slots.empty() && getBuffer() + m_slots.back().offset >= pEnd)
+            m_slots.pop_back();
+    }
+    
+    std::vector<Slot> m_slots;
+};
+
+
+//-----------------------------------------------------------------------------
+
+class InnerEncoder : public Encoder
+{
+public:
+    
+    InnerEncoder(Encoder& rOuterEncoder) 
+        : Encoder(m_encoder), m_rOuter(rOuterEncoder), m_pHeader(nullptr), 
+          m_pNodeArena(rOuterEncoder.getArena())
+    { 
+        setFloatEncoding(rOuterEncoder.getFloatEncoding());
+        setLengthEncoding(rOuterEncoder.getLengthEncoding());
+        setKeyDictionary(rOuterEncoder.getKeyDictionary());
+        setStringRefs(rOuterEncoder.getStringRefs());
+        setGatherList(rOuterEncoder.getGatherList());
+        setCountOverflow(rOuterEncoder.getCountOverflow());
+        setArena(rOuterEncoder.getArena());
+    }
+    
+    virtual ~InnerEncoder() {
+        size_t count = std::numeric_limits<size_t>::max() - encoderRemaining(m_encoder);
+        if (m_pHeader && (m_pHeader[0] & 0xe0) == CborMapType)
+            count /= 2;
+        
+        /* the break byte, or a definite header of up to 9 bytes instead */
+        if (isEncoderLengthUnknown(m_encoder))
+            ensure(m_pHeader ? std::max<size_t>(1, headSize(count) - 1) : 1);
+        
+        cbor_encoder_close_container(&m_rOuter.getEncoder(), &m_encoder);
+        
+        if (m_pHeader)
+            backpatch(count);
+    }
+
+    CborEncoder& getEncoder() { return m_encoder; }
+
+    /* friend functions */
+    friend Encoder& end(Encoder& container);
+    friend Encoder& createMap(Encoder& container, size_t size);
+    friend Encoder& createArray(Encoder& container, size_t size);
+
+
+protected:
+
+    /**
+     * Called after opening an indefinite container at pHeader. tinycbor 
+     * doesn't use remaining of indefinite containers, so every item counts 
+     * it down from the maximum.
+     */
+    void countItems(uint8_t* pHeader)
+    {
+        m_pHeader = pHeader;
+        setEncoderRemaining(m_encoder, std::numeric_limits<size_t>::max());
+    }
+    
+    virtual bool grow(const uint8_t* pUsed, size_t len, Relocation& to)
+    {
+        if (!m_rOuter.grow(pUsed, len, to))
+            return false;
+        
+        relocate(to);
+        if (m_pHeader) {
+            /* an EncoderStream passed the header on, it can't be backpatched */
+            if (m_pHeader < to.pOld)
+                throw EncoderException(CborErrorUnsupportedType);
+            m_pHeader = to.move(m_pHeader);
+        }
+        return true;
+    }
+    
+    virtual void shift(const uint8_t* pFrom, ptrdiff_t delta)
+    {
+        m_rOuter.shift(pFrom, delta);
+    }
+    
+    virtual bool output(uint8_t*& pBegin, uint8_t*& pEnd)
+    {
+        return m_rOuter.output(pBegin, pEnd);
+    }
+    
+    virtual void truncate(const uint8_t* pEnd)
+    {
+        m_rOuter.truncate(pEnd);
+    }
+    
+    virtual size_t maxChunk() { return m_rOuter.maxChunk(); }
+    
+    virtual uint64_t flushed() { return m_rOuter.flushed(); }
+    
+    /* replace the indefinite header and drop the break byte, count in items or pairs */
+    void backpatch(size_t count)
+    {
+        CborEncoder& outer = m_rOuter.getEncoder();
+        uint8_t major = m_pHeader[0] & 0xe0;
+        size_t head = headSize(count);
+        
+        if (!encoderEnd(outer)) {
+            if (head > 2)
+                overflowEncoder(outer, head - 2);
+            return;
+        }
+        if (head > 2 && encoderRoom(outer) < head - 2)
+            return;
+        
+        size_t len = encoderPosition(outer) - 1 - (m_pHeader + 1);
+        memmove(m_pHeader + head, m_pHeader + 1, len);
+        writeHead(m_pHeader, major, count);
+        setEncoderPosition(outer, m_pHeader + head + len);
+        
+        if (getGatherList())
+            getGatherList()->shift(m_pHeader, (ptrdiff_t)head - 1);
+        if (head > 1)
+            m_rOuter.shift(m_pHeader + 1, (ptrdiff_t)head - 1);
+    }
+    
+    CborEncoder m_encoder;
+    Encoder& m_rOuter;
+    uint8_t* m_pHeader;
+    Arena* m_pNodeArena;
+
+};
+
+
+//-----------------------------------------------------------------------------
+
+inline Encoder& end(Encoder& container)
+{
+    if (InnerEncoder* s = dynamic_cast<InnerEncoder*>(&container)) {
+        Encoder& outer = s->m_rOuter;
+        destroyIn(s->m_pNodeArena, s);
+        return outer;
+    }
+
+    return container;
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline Encoder& createMap(Encoder& container, size_t size)
+{
+    InnerEncoder* pInner = createIn<InnerEncoder>(container.getArena(), container);
+    
+    container.ensure(9);
+    CborError err = cbor_encoder_create_map(
+            &container.m_rEncoder, &pInner->getEncoder(), size);
+    
+    container.check(err);
+    
+    if (size == CborIndefiniteLength && container.getLengthEncoding() == LengthDefinite
+            && encoderEnd(container.m_rEncoder))
+        pInner->countItems(encoderPosition(pInner->getEncoder()) - 1);
+    
+    return *pInner;
+}
+
+
+
+//-----------------------------------------------------------------------------
+
+inline Encoder& createArray(Encoder& container, size_t size)
+{
+    InnerEncoder* pInner = createIn<InnerEncoder>(container.getArena(), container);
+    
+    container.ensure(9);
+    CborError err = cbor_encoder_create_array(
+            &container.m_rEncoder, &pInner->getEncoder(), size);
+    
+    container.check(err);
+    
+    if (size == CborIndefiniteLength && container.getLengthEncoding() == LengthDefinite
+            && encoderEnd(container.m_rEncoder))
+        pInner->countItems(encoderPosition(pInner->getEncoder()) - 1);
+    
+    return *pInner;
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline tEncoderFn startMap(size_t size = CborIndefiniteLength)
+{
+    return std::bind(createMap, std::placeholders::_1, size);
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline tEncoderFn startArray(size_t size = CborIndefiniteLength)
+{
+    return std::bind(createArray, std::placeholders::_1, size);
+}
+
+
+//-----------------------------------------------------------------------------
+
+/**
+ * Open a map as a new stringref namespace, repeated strings inside are 
+ * written as references into refs. The table is cleared first.
+ */
+inline Encoder& createStringRefMap(Encoder& container, StringRefTable& refs, size_t size)
+{
+    container.encodeTag(TagStringRefNamespace);
+    refs.clear();
+    
+    Encoder& inner = createMap(container, size);
+    inner.setStringRefs(&refs);
+    return inner;
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline Encoder& createStringRefArray(Encoder& container, StringRefTable& refs, size_t size)
+{
+    container.encodeTag(TagStringRefNamespace);
+    refs.clear();
+    
+    Encoder& inner = createArray(container, size);
+    inner.setStringRefs(&refs);
+    return inner;
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline tEncoderFn startStringRefMap(StringRefTable& refs, size_t size = CborIndefiniteLength)
+{
+    return std::bind(createStringRefMap, std::placeholders::_1, std::ref(refs), size);
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline tEncoderFn startStringRefArray(StringRefTable& refs, size_t size = CborIndefiniteLength)
+{
+    return std::bind(createStringRefArray, std::placeholders::_1, std::ref(refs), size);
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline Encoder& operator << (Encoder& container, const char* str)
+{
+    return container.encode(CString(str));
+}
+
+
+//-----------------------------------------------------------------------------
+
+template <typename T>
+inline Encoder& operator << (Encoder& container, const T& value)
+{
+    return container.encode(value);
+}
+
+
+//-----------------------------------------------------------------------------
+
+template <>
+inline Encoder& operator<< <decltype(end)>(Encoder& container, decltype(end)& op)
+{
+    return op(container);
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline Encoder& operator << (Encoder& container, tEncoderFn op)
+{
+    return op(container);
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline Encoder& operator << (Encoder& container, const std::string& value)
+{
+    return container.encode(CString(value));
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline Encoder& operator << (Encoder& container, const std::vector<uint8_t>& value)
+{
+    return container.encode(CBytes(value));
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline Encoder& operator << (Encoder& container, uint8_t value)
+{
+    return container.encode(CUint(value));
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline Encoder& operator << (Encoder& container, uint16_t value)
+{
+    return container.encode(CUint(value));
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline Encoder& operator << (Encoder& container, uint32_t value)
+{
+    return container.encode(CUint(value));
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline Encoder& operator << (Encoder& container, uint64_t value)
+{
+    return container.encode(CUint(value));
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline Encoder& operator << (Encoder& container, int8_t value)
+{
+    return container.encode(CInt(value));
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline Encoder& operator << (Encoder& container, int16_t value)
+{
+    return container.encode(CInt(value));
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline Encoder& operator << (Encoder& container, int32_t value)
+{
+    return container.encode(CInt(value));
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline Encoder& operator << (Encoder& container, int64_t value)
+{
+    return container.encode(CInt(value));
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline Encoder& operator << (Encoder& container, bool value)
+{
+    return container.encode(CBool(value));
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline Encoder& operator << (Encoder& container, float value)
+{
+    return container.encode(CFloat(value));
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline Encoder& operator << (Encoder& container, double value)
+{
+    return container.encode(CDouble(value));
+}
+
+
+//-----------------------------------------------------------------------------
+// CBOR Decoder
+//-----------------------------------------------------------------------------
+
+class Decoder
+{
+
+public:
+    
+    Decoder(CborValue& position) 
+        : m_it(position), m_pKeys(nullptr), m_pStringRefs(nullptr), 
+          m_chunks(ChunksNone), m_pChunk(nullptr), m_pArena(nullptr) { }
+
+    virtual ~Decoder() { }
+    
+    uint64_t decodeUint() 
+    {   
+        CborError err;
+        uint64_t value_buffer;
+        
+#if TINYCBORWRAPPER_NATIVE
+        uint8_t major;
+        if (readInteger(major, value_buffer) && major == CborIntegerType) {
+            nextFixed();
+            return value_buffer;
+        }
+#endif
+        if ((err = cbor_value_get_uint64(&m_it, &value_buffer)) != CborNoError)
+            throw DecoderException(err);
+        
+        next();
+        
+        return value_buffer;
+    }
+    
+    
+    int64_t decodeInt() 
+    {   
+        CborError err;
+        int64_t value_buffer;
+        
+#if TINYCBORWRAPPER_NATIVE
+        /* out of range values are reported by tinycbor */
+        uint8_t major;
+        uint64_t magnitude;
+        if (readInteger(major, magnitude) && magnitude <= (uint64_t)INT64_MAX) {
+            nextFixed();
+            return major ? -1 - (int64_t)magnitude : (int64_t)magnitude;
+        }
+#endif
+        if ((err = cbor_value_get_int64(&m_it, &value_buffer)) != CborNoError)
+            throw DecoderException(err);
+        
+        next();
+        
+        return value_buffer;
+    }
+    
+    
+    std::string decodeString() 
+    {   
+        const StringRefTable::Entry* pRef = decodeStringRef(true);
+        if (pRef)
+            return std::string(reinterpret_cast<const char*>(pRef->data), pRef->length);
+        
+        if (!isString())
+            throw DecoderException(CborErrorIllegalType);
+        
+        std::string ret;
+        appendString(ret);
+        
+        return ret;
+    }
+    
+    
+    std::vector<uint8_t> decodeBytes()
+    {
+        const StringRefTable::Entry* pRef = decodeStringRef(false);
+        if (pRef)
+            return std::vector<uint8_t>(pRef->data, pRef->data + pRef->length);
+        
+        if (!isBytes())
+            throw DecoderException(CborErrorIllegalType);
+        
+        std::vector<uint8_t> ret;
+        appendString(ret);
+        
+        return ret;
+    }
+    
+    
+    bool decodeBool() 
+    {   
+        CborError err;
+        bool value_buffer;
+        
+#if TINYCBORWRAPPER_NATIVE
+        if (isBool()) {
+            value_buffer = cbor_value_get_next_byte(&m_it)[0] == (CborSimpleType | 21);
+            nextFixed();
+            return value_buffer;
+        }
+#endif
+        err = cbor_value_get_boolean(&m_it, &value_buffer);
+        if (err != CborNoError)
+            throw DecoderException(err);
+        
+        next();
+        
+        return value_buffer;
+    }
+    
+    
+    /* accepts half and single precision floats */
+    float decodeFloat() 
+    {   
+        CborError err;
+        float value_buffer;
+        
+#if TINYCBORWRAPPER_NATIVE
+        if (isFloat()) {
+            uint32_t bits = loadBigEndian<uint32_t>(cbor_value_get_next_byte(&m_it) + 1);
+            memcpy(&value_buffer, &bits, sizeof(value_buffer));
+            nextFixed();
+            return value_buffer;
+        }
+#endif
+        if (isHalfFloat()) {
+            uint16_t half;
+            err = cbor_value_get_half_float(&m_it, &half);
+            value_buffer = halfToFloat(half);
+        } else if (isFloat()) {
+            err = cbor_value_get_float(&m_it, &value_buffer);
+        } else {
+            err = CborErrorIllegalType;
+        }
+        if (err != CborNoError)
+            throw DecoderException(err);
+        
+        next();
+        
+        return value_buffer;
+    }
+    
+    
+    /* accepts half, single and double precision floats */
+    double decodeDouble() 
+    {   
+        CborError err;
+        double value_buffer;
+        
+        if (!isDouble())
+            return decodeFloat();
+        
+#if TINYCBORWRAPPER_NATIVE
+        uint64_t bits = loadBigEndian<uint64_t>(cbor_value_get_next_byte(&m_it) + 1);
+        memcpy(&value_buffer, &bits, sizeof(value_buffer));
+        (void)err;
+        
+        nextFixed();
+#else
+        err = cbor_value_get_double(&m_it, &value_buffer);
+        if (err != CborNoError)
+            throw DecoderException(err);
+        
+        next();
+#endif
+        
+        return value_buffer;
+    }
+    
+    
+    template <typename T>
+    uint64_t decode(TUint<T>& value) 
+    {   
+        value.set(decodeUint());
+        return value.value;
+    }
+
+    template <typename T>
+    int64_t decode(TInt<T>& value) 
+    {   
+        value.set(decodeInt());
+        return value.value;
+    }
+
+    template <typename T>
+    std::string decode(TString<T>& value) 
+    {   
+        value.set(decodeString());
+        return value.value;
+    }
+    
+    std::vector<uint8_t> decode(TBytes< std::vector<uint8_t> >& value) 
+    {   
+        value.set(decodeBytes());
+        return value.value;
+    }
+    
+    template <typename T>
+    bool decode(TBool<T>& value) 
+    {   
+        value.set(decodeBool());
+        return value.value;
+    }
+    
+    template <typename T>
+    float decode(TFloat<T>& value) 
+    {   
+        value.set(decodeFloat());
+        return value.value;
+    }
+    
+    template <typename T>
+    double decode(TDouble<T>& value) 
+    {   
+        value.set(decodeDouble());
+        return value.value;
+    }
+    
+    
+    bool isMap() { return cbor_value_is_map(&m_it); }
+    
+    bool isArray() { return cbor_value_is_array(&m_it); }
+    
+    bool isString() { return cbor_value_is_text_string(&m_it); }
+    
+    bool isBytes() { return cbor_value_is_byte_string(&m_it); }
+    
+    bool isInt() { return cbor_value_is_integer(&m_it); }
+    
+    bool isUint() { return cbor_value_is_unsigned_integer(&m_it); }
+    
+    bool isBool() { return cbor_value_is_boolean(&m_it); }
+    
+    bool isHalfFloat() { return cbor_value_is_half_float(&m_it); }
+    
+    bool isFloat() { return cbor_value_is_float(&m_it); }
+    
+    bool isDouble() { return cbor_value_is_double(&m_it); }
+    
+    bool isUndefined() { return cbor_value_is_undefined(&m_it); }
+    
+    bool isNull() { return cbor_value_is_null(&m_it); }
+    
+    bool isTag() { return cbor_value_is_tag(&m_it); }
+    
+    bool isLengthKnown() { return cbor_value_is_length_known(&m_it); }
+    
+    bool atEnd() { return cbor_value_at_end(&m_it); }
+    
+    size_t getArrayLength() 
+    { 
+        size_t len; 
+        CborError err = cbor_value_get_array_length(&m_it, &len);
+        if (err != CborNoError)
+            throw DecoderException(err);
+        return len;
+    }
+    
+    size_t getMapLength() 
+    { 
+        size_t len; 
+        CborError err = cbor_value_get_map_length(&m_it, &len);
+        if (err != CborNoError)
+            throw DecoderException(err);
+        return len;
+    }
+    
+    void next() 
+    { 
+        CborError err = cbor_value_advance(&m_it);
+        if (err != CborNoError)
+            throw DecoderException(err);
+    }
+
+    /**
+     * Decode an array of numbers, definite length arrays are parsed in a 
+     * single pass without going through tinycbor per item.
+     */
+    template <typename T>
+    void decodeNumbers(std::vector<T>& values)
+    {
+        static_assert(IsNumber<T>::value, "integer or floating point type expected");
+        
+        values.clear();
+        
+        if (isTag()) {
+            decodeTypedArray(values);
+            return;
+        }
+        
+        if (isArray() && isLengthKnown()) {
+            size_t count = getArrayLength();
+            if (count > (size_t)(parserEnd(m_it) - cbor_value_get_next_byte(&m_it)))
+                throw DecoderException(CborErrorUnexpectedEOF);
+            values.resize(count);
+            decodeNumbers(values.data(), count);
+            return;
+        }
+        
+        if (!isArray())
+            throw DecoderException(CborErrorIllegalType);
+        
+        CborValue inner;
+        CborError err = cbor_value_enter_container(&m_it, &inner);
+        if (err != CborNoError)
+            throw DecoderException(err);
+        
+        Decoder items(inner);
+        while (!items.atEnd()) {
+            T value;
+            items >> value;
+            values.push_back(value);
+        }
+        
+        err = cbor_value_leave_container(&m_it, &inner);
+        if (err != CborNoError)
+            throw DecoderException(err);
+    }
+    
+    /* decode a definite length array of exactly count numbers */
+    template <typename T>
+    void decodeNumbers(T* values, size_t count)
+    {
+        static_assert(IsNumber<T>::value, "integer or floating point type expected");
+        
+        if (!isArray() || !isLengthKnown())
+            throw DecoderException(CborErrorIllegalType);
+        if (getArrayLength() != count)
+            throw DecoderException(
+                    getArrayLength() < count ? CborErrorTooFewItems : CborErrorTooManyItems);
+        
+        CborValue inner;
+        CborError err = cbor_value_enter_container(&m_it, &inner);
+        if (err != CborNoError)
+            throw DecoderException(err);
+        
+        const uint8_t* p = cbor_value_get_next_byte(&inner);
+        const uint8_t* pEnd = parserEnd(m_it);
+        
+        for (size_t i = 0; i < count; ++i) {
+            if (p == pEnd)
+                throw DecoderException(CborErrorUnexpectedEOF);
+            p = readNumber(p, pEnd, values[i]);
+        }
+        
+        /* hand the position back to tinycbor as an exhausted container */
+        finishContainer(inner, p);
+        
+        err = cbor_value_leave_container(&m_it, &inner);
+        if (err != CborNoError)
+            throw DecoderException(err);
+    }
+    
+    /**
+     * Decode an RFC 8746 typed array of T, the data is copied with one memcpy 
+     * and byte swapped if its byte order isn't the native one.
+     */
+    template <typename T>
+    void decodeTypedArray(std::vector<T>& values)
+    {
+        bool little_endian = enterTypedArray<T>();
+        
+        const StringRefTable::Entry* pRef = decodeStringRef(false);
+        if (pRef) {
+            if (pRef->length % sizeof(T))
+                throw DecoderException(CborErrorIllegalNumber);
+            
+            values.resize(pRef->length / sizeof(T));
+            if (pRef->length)
+                memcpy(values.data(), pRef->data, pRef->length);
+        } else {
+            size_t len;
+            CborError err = cbor_value_calculate_string_length(&m_it, &len);
+            if (err != CborNoError)
+                throw DecoderException(err);
+            if (len % sizeof(T))
+                throw DecoderException(CborErrorIllegalNumber);
+            
+            values.resize(len / sizeof(T));
+            err = cbor_value_copy_byte_string(
+                    &m_it, reinterpret_cast<uint8_t*>(values.data()), &len, &m_it);
+            if (err != CborNoError)
+                throw DecoderException(err);
+        }
+        
+        if (little_endian != nativeLittleEndian()) {
+            for (size_t i = 0; i < values.size(); ++i)
+                values[i] = byteSwapValue(values[i]);
+        }
+    }
+    
+    /* decode an RFC 8746 typed array of T without copying, the input must 
+     * outlive the view and must not be a chunked byte string */
+    template <typename T>
+    TypedArrayView<T> decodeTypedArrayView()
+    {
+        bool little_endian = enterTypedArray<T>();
+        
+        size_t len;
+        const uint8_t* p = decodeStringView(len);
+        if (len % sizeof(T))
+            throw DecoderException(CborErrorIllegalNumber);
+        
+        TypedArrayView<T> view;
+        view.data = p;
+        view.size = len / sizeof(T);
+        view.swapped = little_endian != nativeLittleEndian();
+        
+        return view;
+    }
+    
+    /**
+     * Zero copy access to a definite length byte or text string, returns a 
+     * pointer into the input which has to outlive its use.
+     */
+    const uint8_t* decodeStringView(size_t& len)
+    {
+        const StringRefTable::Entry* pRef = decodeStringRef(false, true);
+        if (pRef) {
+            len = pRef->length;
+            return pRef->data;
+        }
+        
+        if (!isBytes() && !isString())
+            throw DecoderException(CborErrorIllegalType);
+        if (!isLengthKnown())
+            throw DecoderException(CborErrorUnknownLength);
+        
+        const uint8_t* pEnd = parserEnd(m_it);
+        uint64_t length;
+        const uint8_t* p = readHead(cbor_value_get_next_byte(&m_it), pEnd, length);
+        if (!p || length > (uint64_t)(pEnd - p))
+            throw DecoderException(CborErrorUnexpectedEOF);
+        
+        next();
+        
+        len = (size_t)length;
+        return p;
+    }
+    
+    /**
+     * Views of the chunks of the next byte or text string, returns false 
+     * after the last one and moves on to the next item. Definite length 
+     * strings and string references are a single chunk.
+     */
+    bool readChunk(const uint8_t*& data, size_t& len)
+    {
+        if (m_chunks == ChunksDone) {
+            m_chunks = ChunksNone;
+            return false;
+        }
+        
+        if (m_chunks == ChunksNone) {
+            if (isTag() || isLengthKnown()) {
+                data = decodeStringView(len);
+                m_chunks = ChunksDone;
+                return true;
+            }
+            if (!isBytes() && !isString())
+                throw DecoderException(CborErrorIllegalType);
+            
+            m_pChunk = cbor_value_get_next_byte(&m_it) + 1;
+            m_chunks = ChunksIndefinite;
+        }
+        
+        const uint8_t* pEnd = parserEnd(m_it);
+        if (m_pChunk == pEnd)
+            throw DecoderException(CborErrorUnexpectedEOF);
+        
+        if (*m_pChunk == 0xff) {
+            /* only walks the chunk headers once more */
+            m_chunks = ChunksNone;
+            CborError err = cbor_value_advance(&m_it);
+            if (err != CborNoError)
+                throw DecoderException(err);
+            return false;
+        }
+        
+        uint8_t major = cbor_value_get_next_byte(&m_it)[0] & 0xe0;
+        if ((m_pChunk[0] & 0xe0) != major)
+            throw DecoderException(CborErrorIllegalType);
+        
+        uint64_t length;
+        const uint8_t* p = readHead(m_pChunk, pEnd, length);
+        if (!p || length > (uint64_t)(pEnd - p))
+            throw DecoderException(CborErrorUnexpectedEOF);
+        
+        data = p;
+        len = (size_t)length;
+        m_pChunk = p + len;
+        return true;
+    }
+    
+    /* append the content of the next byte or text string in a single pass */
+    template <typename T>
+    Decoder& appendString(T& target)
+    {
+        const uint8_t* data;
+        size_t len;
+        
+        while (readChunk(data, len))
+            target.insert(target.end(), data, data + len);
+        
+        return *this;
+    }
+    
+    /**
+     * Map key written as CKey, integer keys are resolved by the dictionary. 
+     * Throws CborErrorImproperValue for an id the dictionary doesn't know, 
+     * e.g. from another dictionary version, and CborErrorIllegalType for 
+     * negative integer keys. The key isn't consumed in both cases.
+     */
+    std::string decodeKey()
+    {
+        if (!isInt())
+            return decodeString();
+        if (!isUint())
+            throw DecoderException(CborErrorIllegalType);
+        
+        uint64_t id;
+        CborError err = cbor_value_get_uint64(&m_it, &id);
+        if (err != CborNoError)
+            throw DecoderException(err);
+        
+        const std::string* pName = m_pKeys ? m_pKeys->name(id) : nullptr;
+        if (!pName)
+            throw DecoderException(CborErrorImproperValue);
+        
+        next();
+        return *pName;
+    }
+    
+    /* containers entered from this one afterwards are allocated in the arena */
+    void setArena(Arena* pArena) { m_pArena = pArena; }
+    
+    Arena* getArena() { return m_pArena; }
+    
+    /* applies to this and all containers entered from it afterwards, 
+     * the dictionary has to outlive the decoder */
+    void setKeyDictionary(const KeyDictionary* pKeys) { m_pKeys = pKeys; }
+    
+    const KeyDictionary* getKeyDictionary() { return m_pKeys; }
+    
+    /* resolves string references in this and all containers entered from 
+     * it afterwards, see enterStringRefs() */
+    void setStringRefs(const StringRefTable* pStringRefs) { m_pStringRefs = pStringRefs; }
+    
+    const StringRefTable* getStringRefs() { return m_pStringRefs; }
+    
+    CborValue& getIterator() { return m_it; }
+    
+protected:
+    
+#if TINYCBORWRAPPER_NATIVE
+    /* major type and argument of the current integer, read from the input */
+    bool readInteger(uint8_t& major, uint64_t& value)
+    {
+        if (!isInt())
+            return false;
+        
+        const uint8_t* p = cbor_value_get_next_byte(&m_it);
+        major = p[0] & 0xe0;
+        return readHead(p, parserEnd(m_it), value) != nullptr;
+    }
+    
+    /* skips an integer, bool or float, cheaper than next() */
+    void nextFixed()
+    {
+        CborError err = cbor_value_advance_fixed(&m_it);
+        if (err != CborNoError)
+            throw DecoderException(err);
+    }
+#endif
+    
+    /**
+     * Consume a string reference, nullptr if the next item isn't one. Throws
+     * if the string has the wrong major type, any type is fine for a view.
+     */
+    const StringRefTable::Entry* decodeStringRef(bool text, bool any = false)
+    {
+        CborTag tag;
+        
+        if (!m_pStringRefs || !isTag())
+            return nullptr;
+        if (cbor_value_get_tag(&m_it, &tag) != CborNoError || tag != TagStringRef)
+            return nullptr;
+        
+        CborValue position = m_it;
+        next();
+        
+        const StringRefTable::Entry* pRef = isUint() ? m_pStringRefs->get(decodeUint()) : nullptr;
+        if (!pRef || (!any && pRef->text != text)) {
+            m_it = position;
+            throw DecoderException(pRef ? CborErrorIllegalType : CborErrorImproperValue);
+        }
+        
+        return pRef;
+    }
+    
+    /* check and skip the typed array tag, returns the byte order of the data. 
+     * The data is a byte string or, inside a namespace, a reference to one. */
+    template <typename T>
+    bool enterTypedArray()
+    {
+        CborTag tag;
+        CborTag ref;
+        bool little_endian;
+        
+        if (!isTag())
+            throw DecoderException(CborErrorIllegalType);
+        
+        CborError err = cbor_value_get_tag(&m_it, &tag);
+        if (err != CborNoError)
+            throw DecoderException(err);
+        if (!isTypedArrayTag<T>(tag, little_endian))
+            throw DecoderException(CborErrorInappropriateTagForType);
+        
+        next();
+        
+        bool is_ref = m_pStringRefs && isTag() 
+                && cbor_value_get_tag(&m_it, &ref) == CborNoError && ref == TagStringRef;
+        if (!isBytes() && !is_ref)
+            throw DecoderException(CborErrorInappropriateTagForType);
+        
+        return little_endian;
+    }
+    
+    template <typename T>
+    static const uint8_t* readNumber(const uint8_t* p, const uint8_t* pEnd, T& value)
+    {
+        static_assert(std::is_integral<T>::value, "integer type expected");
+        
+        uint8_t major = p[0] & 0xe0;
+        uint64_t arg;
+        
+        if (major != CborIntegerType && (major != 0x20 || !std::is_signed<T>::value))
+            throw DecoderException(CborErrorIllegalType);
+        
+        p = readHead(p, pEnd, arg);
+        if (!p)
+            throw DecoderException(CborErrorUnexpectedEOF);
+        if (arg > (uint64_t)std::numeric_limits<T>::max())
+            throw DecoderException(CborErrorDataTooLarge);
+        
+        value = major ? (T)(-1 - (int64_t)arg) : (T)arg;
+        return p;
+    }
+    
+    static const uint8_t* readNumber(const uint8_t* p, const uint8_t* pEnd, double& value)
+    {
+        size_t left = pEnd - p;
+        
+        if (p[0] == CborDoubleType && left >= 9) {
+            uint64_t bits = loadBigEndian<uint64_t>(p + 1);
+            memcpy(&value, &bits, sizeof(value));
+            return p + 9;
+        }
+        
+        float f;
+        p = readNumber(p, pEnd, f);
+        value = f;
+        return p;
+    }
+    
+    static const uint8_t* readNumber(const uint8_t* p, const uint8_t* pEnd, float& value)
+    {
+        size_t left = pEnd - p;
+        
+        if (p[0] == CborFloatType && left >= 5) {
+            uint32_t bits = loadBigEndian<uint32_t>(p + 1);
+            memcpy(&value, &bits, sizeof(value));
+            return p + 5;
+        }
+        if (p[0] == CborHalfFloatType && left >= 3) {
+            value = halfToFloat(loadBigEndian<uint16_t>(p + 1));
+            return p + 3;
+        }
+        
+        if (p[0] == CborFloatType || p[0] == CborHalfFloatType || p[0] == CborDoubleType)
+            throw DecoderException(p[0] == CborDoubleType 
+                    ? CborErrorIllegalType : CborErrorUnexpectedEOF);
+        throw DecoderException(CborErrorIllegalType);
+    }
+
+    enum ChunkState
+    {
+        ChunksNone,
+        ChunksIndefinite,
+        ChunksDone
+    };
+    
+    CborValue& m_it;
+    const KeyDictionary* m_pKeys;
+    const StringRefTable* m_pStringRefs;
+    ChunkState m_chunks;
+    const uint8_t* m_pChunk;
+    Arena* m_pArena;
+
+};
+
+
+//-----------------------------------------------------------------------------
+
+class DecoderBuffer : public Decoder
+{
+
+public:
+    
+    DecoderBuffer(uint8_t* pBuffer, size_t buffer_size) 
+        : Decoder(m_it), m_pBuffer(pBuffer)
+    { 
+        cbor_parser_init(pBuffer, buffer_size, 0, &m_parser, &m_it);
+    }
+
+    virtual ~DecoderBuffer() { }    
+    
+private:
+    uint8_t* m_pBuffer;
+    CborParser m_parser;
+    CborValue m_it;
+};
+
+
+//-----------------------------------------------------------------------------
+
+class InnerDecoder : public Decoder
+{
+
+public:
+    
+    InnerDecoder(Decoder& rOuter) 
+        : Decoder(m_it), m_rOuter(rOuter), m_pNodeArena(rOuter.getArena()) 
+    {
+        setKeyDictionary(rOuter.getKeyDictionary());
+        setStringRefs(rOuter.getStringRefs());
+        setArena(rOuter.getArena());
+        if (!cbor_value_is_container(&m_rOuter.getIterator()))
+            throw DecoderException(CborErrorUnknownType);
+        cbor_value_enter_container(&m_rOuter.getIterator(), &m_it);
+    }
+    
+    virtual ~InnerDecoder() {
+        cbor_value_leave_container(&m_rOuter.getIterator(), &m_it);
+    }    
+    
+    Decoder& getOuter() { return m_rOuter; }
+    
+    /* arena the decoder itself was allocated in, see enter() */
+    Arena* getNodeArena() { return m_pNodeArena; }
+    
+private:
+
+    Decoder& m_rOuter;
+    Arena* m_pNodeArena;
+    CborValue m_it;
+};
+
+
+//-----------------------------------------------------------------------------
+
+inline Decoder& leave(Decoder& container)
+{
+    if (InnerDecoder* s = dynamic_cast<InnerDecoder*>(&container)) {
+        Decoder& outer = s->getOuter();
+        destroyIn(s->getNodeArena(), s);
+        return outer;
+    }
+
+    return container;
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline Decoder& enter(Decoder& container)
+{
+    InnerDecoder* pInner = createIn<InnerDecoder>(container.getArena(), container);
+    return *pInner;
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline Decoder& skip(Decoder& container)
+{
+    container.next();
+    return container;
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline Decoder& operator >> (Decoder& container, tDecoderFn op)
+{
+    return op(container);
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline Decoder& operator >> (Decoder& container, std::string& value)
+{
+    value = container.decodeString();
+    return container;
+}
+
+
+//-----------------------------------------------------------------------------
+
+/* strings with another allocator, e.g. ArenaAllocator or std::pmr */
+template <typename Alloc>
+inline Decoder& operator >> (Decoder& container, 
+        std::basic_string<char, std::char_traits<char>, Alloc>& value)
+{
+    if (!container.isString() && !container.isTag())
+        throw DecoderException(CborErrorIllegalType);
+    
+    value.clear();
+    return container.appendString(value);
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline Decoder& operator >> (Decoder& container, uint8_t& value)
+{
+    value = container.decodeUint();
+    return container;
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline Decoder& operator >> (Decoder& container, uint16_t& value)
+{
+    value = container.decodeUint();
+    return container;
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline Decoder& operator >> (Decoder& container, uint32_t& value)
+{
+    value = container.decodeUint();
+    return container;
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline Decoder& operator >> (Decoder& container, uint64_t& value)
+{
+    value = container.decodeUint();
+    return container;
+}
+
+//-----------------------------------------------------------------------------
+
+inline Decoder& operator >> (Decoder& container, int8_t& value)
+{
+    value = container.decodeInt();
+    return container;
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline Decoder& operator >> (Decoder& container, int16_t& value)
+{
+    value = container.decodeInt();
+    return container;
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline Decoder& operator >> (Decoder& container, int32_t& value)
+{
+    value = container.decodeInt();
+    return container;
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline Decoder& operator >> (Decoder& container, int64_t& value)
+{
+    value = container.decodeInt();
+    return container;
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline Decoder& operator >> (Decoder& container, bool& value)
+{
+    value = container.decodeBool();
+    return container;
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline Decoder& operator >> (Decoder& container, std::vector<uint8_t>& value)
+{
+    value = container.decodeBytes();
+    return container;
+}
+
+
+//-----------------------------------------------------------------------------
+
+template <typename Alloc>
+inline Decoder& operator >> (Decoder& container, std::vector<uint8_t, Alloc>& value)
+{
+    if (!container.isBytes() && !container.isTag())
+        throw DecoderException(CborErrorIllegalType);
+    
+    value.clear();
+    return container.appendString(value);
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline Decoder& operator >> (Decoder& container, float& value)
+{
+    value = container.decodeFloat();
+    return container;
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline Decoder& operator >> (Decoder& container, double& value)
+{
+    value = container.decodeDouble();
+    return container;
+}
+
+//-----------------------------------------------------------------------------
+
+template <typename T>
+inline Decoder& readValue(Decoder& container, T& value)
+{
+    container.decode(value);
+    return container;
+}
+
+
+//-----------------------------------------------------------------------------
+
+template <typename T>
+inline tDecoderFn RString(T& value)
+{
+    TString<T> target(value);
+    return std::bind(readValue< TString<T> >, 
+            std::placeholders::_1, std::ref(target));
+}
+
+
+//-----------------------------------------------------------------------------
+
+template <typename T>
+inline tDecoderFn RBytes(T& value)
+{
+    TBytes<T> target(value);
+    return std::bind(readValue< TBytes<T> >, 
+            std::placeholders::_1, std::ref(target));
+}
+
+
+//-----------------------------------------------------------------------------
+
+template <typename T>
+inline tDecoderFn RUint(T& value)
+{
+    TUint<T> target(value);
+    return std::bind(readValue< TUint<T> >, 
+            std::placeholders::_1, std::ref(target));
+}
+
+
+//-----------------------------------------------------------------------------
+
+template <typename T>
+inline tDecoderFn RInt(T& value)
+{
+    TInt<T> target(value);
+    return std::bind(readValue< TInt<T> >, 
+            std::placeholders::_1, std::ref(target));
+}
+
+
+//-----------------------------------------------------------------------------
+
+template <typename T>
+inline tDecoderFn RBool(T& value)
+{
+    TBool<T> target(value);
+    return std::bind(readValue< TBool<T> >, 
+            std::placeholders::_1, std::ref(target));
+}
+
+
+//-----------------------------------------------------------------------------
+
+template <typename T>
+inline tDecoderFn RFloat(T& value)
+{
+    TFloat<T> target(value);
+    return std::bind(readValue< TFloat<T> >, 
+            std::placeholders::_1, std::ref(target));
+}
+
+
+//-----------------------------------------------------------------------------
+
+template <typename T>
+inline tDecoderFn RDouble(T& value)
+{
+    TDouble<T> target(value);
+    return std::bind(readValue< TFloat<T> >, 
+            std::placeholders::_1, std::ref(target));
+}
+
+
+//-----------------------------------------------------------------------------
+
+template <typename T>
+inline Decoder& readTypedArray(Decoder& container, std::vector<T>& values)
+{
+    container.decodeTypedArray(values);
+    return container;
+}
+
+
+//-----------------------------------------------------------------------------
+
+template <typename T>
+inline tDecoderFn RTypedArray(std::vector<T>& values)
+{
+    return std::bind(readTypedArray<T>, std::placeholders::_1, std::ref(values));
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline Decoder& readKey(Decoder& container, std::string& key)
+{
+    key = container.decodeKey();
+    return container;
+}
+
+
+//-----------------------------------------------------------------------------
+
+inline tDecoderFn RKey(std::string& key)
+{
+    return std::bind(readKey, std::placeholders::_1, std::ref(key));
+}
+
+
+//-----------------------------------------------------------------------------
+// Standard Containers
+//-----------------------------------------------------------------------------
+
+/**
+ * Number of entries to reserve for the current array or map, 0 if the length
+ * is unknown. Bounded by the remaining input, every item takes at least one 
+ * byte, so corrupt lengths can't trigger huge allocations.
+ */
+inline size_t reserveLength(Decoder& container)
+{
+    if (!container.isLengthKnown())
+        return 0;
+    
+    const CborValue& it = container.getIterator();
+    size_t available = parserEnd(it) - cbor_value_get_next_byte(&it);
+    
+    if (container.isMap())
+        return std::min(container.getMapLength(), available / 2);
+    
+    return std::min(container.getArrayLength(), available);
+}
+
+
+//-----------------------------------------------------------------------------
+
+template <typename TIter>
+inline Encoder& encodeArray(Encoder& container, TIter first, TIter last, size_t size)
+{
+    Encoder& inner = createArray(container, size);
+    for (; first != last; ++first)
+        inner << *first;
+    
+    return end(inner);
+}
+
+
+//-----------------------------------------------------------------------------
+
+/* string keys go through the encoder's KeyDictionary */
+template <typename TKey>
+inline Encoder& encodeMapKey(Encoder& container, const TKey& key)
+{
+    return container << key;
+}
+
+inline Encoder& encodeMapKey(Encoder& container, const std::string& key)
+{
+    return container.encode(CKey(key));
+}
+
+inline Encoder& encodeMapKey(Encoder& container, const char* key)
+{
+    return container.encode(CKey(key));
+}
+
+
+//-----------------------------------------------------------------------------
+
+template <typename TKey>
+inline Decoder& decodeMapKey(Decoder& container, TKey& key)
+{
+    return container >> key;
+}
+
+inline Decoder& decodeMapKey(Decoder& container, std::string& key)
+{
+    return readKey(container, key);
+}
+
+
+//-----------------------------------------------------------------------------
+
+template <typename TIter>
+inline Encoder& encodeMap(Encoder& container, TIter first, TIter last, size_t size)
+{
+    Encoder& inner = createMap(container, size);
+    for (; first != last; ++first)
+        encodeMapKey(inner, first->first) << first->second;
+    
+    return end(inner);
+}
+
+
+//-----------------------------------------------------------------------------
+
+template <typename TMap>
+inline Decoder& decodeMap(Decoder& container, TMap& value)
+{
+    value.clear();
+    
+    Decoder& inner = enter(container);
+    while (!inner.atEnd()) {
+        typename TMap::key_type key;
+        typename TMap::mapped_type mapped;
+        decodeMapKey(inner, key) >> mapped;
+        value.emplace_hint(value.end(), std::move(key), std::move(mapped));
+    }
+    
+    return leave(inner);
+}
+
+
+//-----------------------------------------------------------------------------
+
+template <typename T, typename TAlloc>
+inline Encoder& encodeVector(Encoder& container, 
+        const std::vector<T, TAlloc>& value, std::true_type)
+{
+    return container.encodeNumbers(value.data(), value.size());
+}
+
+
+//-----------------------------------------------------------------------------
+
+template <typename T, typename TAlloc>
+inline Encoder& encodeVector(Encoder& container, 
+        const std::vector<T, TAlloc>& value, std::false_type)
+{
+    return encodeArray(container, value.begin(), value.end(), value.size());
+}
+
+
+//-----------------------------------------------------------------------------
+
+template <typename T, typename TAlloc>
+inline Decoder& decodeVector(Decoder& container, 
+        std::vector<T, TAlloc>& value, std::true_type)
+{
+    container.decodeNumbers(value);
+    return container;
+}
+
+
+//-----------------------------------------------------------------------------
+
+template <typename T, typename TAlloc>
+inline Decoder& decodeVector(Decoder& container, 
+        std::vector<T, TAlloc>& value, std::false_type)
+{
+    value.clear();
+    value.reserve(reserveLength(container));
+    
+    Decoder& inner = enter(container);
+    while (!inner.atEnd()) {
+        T item;
+        inner >> item;
+        value.push_back(std::move(item));
+    }
+    
+    return leave(inner);
+}
+
+
+//-----------------------------------------------------------------------------
+
+template <typename T, typename TAlloc>
+inline Encoder& operator << (Encoder& container, const std::vector<T, TAlloc>& value)
+{
+    return encodeVector(container, value, IsNumber<T>());
 }
 
 
 //-----------------------------------------------------------------------------
 
-inline Decoder& enter(Decoder& container)
+template <typename T, typename TAlloc>
+inline Decoder& operator >> (Decoder& container, std::vector<T, TAlloc>& value)
 {
-    InnerDecoder* pInner = new InnerDecoder(container);
-    return *pInner;
+    return decodeVector(container, value, IsNumber<T>());
 }
 
 
 //-----------------------------------------------------------------------------
 
-inline Decoder& skip(Decoder& container)
+template <typename T, size_t N>
+inline Encoder& encodeStdArray(Encoder& container, 
+        const std::array<T, N>& value, std::true_type)
 {
-    container.next();
-    return container;
+    return container.encodeNumbers(value.data(), N);
 }
 
 
 //-----------------------------------------------------------------------------
 
-inline Decoder& operator >> (Decoder& container, tDecoderFn op)
+template <typename T, size_t N>
+inline Encoder& encodeStdArray(Encoder& container, 
+        const std::array<T, N>& value, std::false_type)
 {
-    return op(container);
+    return encodeArray(container, value.begin(), value.end(), N);
 }
 
 
 //-----------------------------------------------------------------------------
 
-inline Decoder& operator >> (Decoder& container, std::string& value)
+template <typename T, size_t N>
+inline Decoder& decodeStdArray(Decoder& container, 
+        std::array<T, N>& value, std::true_type)
 {
-    value = container.decodeString();
-    return container;
+    if (container.isArray() && container.isLengthKnown()) {
+        container.decodeNumbers(value.data(), N);
+        return container;
+    }
+    
+    return decodeStdArray(container, value, std::false_type());
 }
 
 
 //-----------------------------------------------------------------------------
 
-inline Decoder& operator >> (Decoder& container, uint8_t& value)
+template <typename T, size_t N>
+inline Decoder& decodeStdArray(Decoder& container, 
+        std::array<T, N>& value, std::false_type)
 {
-    value = container.decodeUint();
-    return container;
+    Decoder& inner = enter(container);
+    for (size_t i = 0; i < N; ++i) {
+        if (inner.atEnd())
+            throw DecoderException(CborErrorTooFewItems);
+        inner >> value[i];
+    }
+    
+    if (!inner.atEnd())
+        throw DecoderException(CborErrorTooManyItems);
+    
+    return leave(inner);
 }
 
 
 //-----------------------------------------------------------------------------
 
-inline Decoder& operator >> (Decoder& container, uint16_t& value)
+template <typename T, size_t N>
+inline Encoder& operator << (Encoder& container, const std::array<T, N>& value)
 {
-    value = container.decodeUint();
-    return container;
+    return encodeStdArray(container, value, IsNumber<T>());
 }
 
 
 //-----------------------------------------------------------------------------
 
-inline Decoder& operator >> (Decoder& container, uint32_t& value)
+template <typename T, size_t N>
+inline Decoder& operator >> (Decoder& container, std::array<T, N>& value)
 {
-    value = container.decodeUint();
-    return container;
+    return decodeStdArray(container, value, IsNumber<T>());
 }
 
 
 //-----------------------------------------------------------------------------
 
-inline Decoder& operator >> (Decoder& container, uint64_t& value)
+template <typename TKey, typename T, typename TCmp, typename TAlloc>
+inline Encoder& operator << (Encoder& container, const std::map<TKey, T, TCmp, TAlloc>& value)
 {
-    value = container.decodeUint();
-    return container;
+    return encodeMap(container, value.begin(), value.end(), value.size());
 }
 
+
 //-----------------------------------------------------------------------------
 
-inline Decoder& operator >> (Decoder& container, int8_t& value)
+template <typename TKey, typename T, typename TCmp, typename TAlloc>
+inline Decoder& operator >> (Decoder& container, std::map<TKey, T, TCmp, TAlloc>& value)
 {
-    value = container.decodeInt();
-    return container;
+    return decodeMap(container, value);
 }
 
 
 //-----------------------------------------------------------------------------
 
-inline Decoder& operator >> (Decoder& container, int16_t& value)
+template <typename TKey, typename T, typename THash, typename TEq, typename TAlloc>
+inline Encoder& operator << (Encoder& container, 
+        const std::unordered_map<TKey, T, THash, TEq, TAlloc>& value)
 {
-    value = container.decodeInt();
-    return container;
+    return encodeMap(container, value.begin(), value.end(), value.size());
 }
 
 
 //-----------------------------------------------------------------------------
 
-inline Decoder& operator >> (Decoder& container, int32_t& value)
+template <typename TKey, typename T, typename THash, typename TEq, typename TAlloc>
+inline Decoder& operator >> (Decoder& container, 
+        std::unordered_map<TKey, T, THash, TEq, TAlloc>& value)
 {
-    value = container.decodeInt();
-    return container;
+    value.clear();
+    value.reserve(reserveLength(container));
+    return decodeMap(container, value);
 }
 
 
 //-----------------------------------------------------------------------------
 
-inline Decoder& operator >> (Decoder& container, int64_t& value)
+template <typename T1, typename T2>
+inline Encoder& operator << (Encoder& container, const std::pair<T1, T2>& value)
 {
-    value = container.decodeInt();
-    return container;
+    return end(createArray(container, 2) << value.first << value.second);
 }
 
 
 //-----------------------------------------------------------------------------
 
-inline Decoder& operator >> (Decoder& container, bool& value)
+template <size_t I, size_t N>
+struct TupleCodec
 {
-    value = container.decodeBool();
-    return container;
-}
+    template <typename TTuple>
+    static void encode(Encoder& container, const TTuple& value)
+    {
+        container << std::get<I>(value);
+        TupleCodec<I + 1, N>::encode(container, value);
+    }
+    
+    template <typename TTuple>
+    static void decode(Decoder& container, TTuple& value)
+    {
+        if (container.atEnd())
+            throw DecoderException(CborErrorTooFewItems);
+        container >> std::get<I>(value);
+        TupleCodec<I + 1, N>::decode(container, value);
+    }
+};
+
+template <size_t N>
+struct TupleCodec<N, N>
+{
+    template <typename TTuple>
+    static void encode(Encoder&, const TTuple&) { }
+    
+    template <typename TTuple>
+    static void decode(Decoder& container, TTuple&) 
+    { 
+        if (!container.atEnd())
+            throw DecoderException(CborErrorTooManyItems);
+    }
+};
 
 
 //-----------------------------------------------------------------------------
 
-inline Decoder& operator >> (Decoder& container, std::vector<uint8_t>& value)
+/* array of exactly N items into a std::pair or std::tuple, a definite 
+ * length is checked before entering */
+template <size_t N, typename TTuple>
+inline Decoder& decodeTuple(Decoder& container, TTuple& value)
 {
-    value = container.decodeBytes();
-    return container;
+    if (container.isArray() && container.isLengthKnown()) {
+        size_t len = container.getArrayLength();
+        if (len != N)
+            throw DecoderException(len < N ? CborErrorTooFewItems : CborErrorTooManyItems);
+    }
+    
+    Decoder& inner = enter(container);
+    TupleCodec<0, N>::decode(inner, value);
+    return leave(inner);
 }
 
 
 //-----------------------------------------------------------------------------
 
-inline Decoder& operator >> (Decoder& container, float& value)
+template <typename T1, typename T2>
+inline Decoder& operator >> (Decoder& container, std::pair<T1, T2>& value)
 {
-    value = container.decodeFloat();
-    return container;
+    return decodeTuple<2>(container, value);
 }
 
 
 //-----------------------------------------------------------------------------
 
-inline Decoder& operator >> (Decoder& container, double& value)
+template <typename... T>
+inline Encoder& operator << (Encoder& container, const std::tuple<T...>& value)
 {
-    value = container.decodeDouble();
-    return container;
+    Encoder& inner = createArray(container, sizeof...(T));
+    TupleCodec<0, sizeof...(T)>::encode(inner, value);
+    return end(inner);
 }
 
+
 //-----------------------------------------------------------------------------
 
-template <typename T>
-inline Decoder& readValue(Decoder& container, T& value)
+template <typename... T>
+inline Decoder& operator >> (Decoder& container, std::tuple<T...>& value)
 {
-    container.decode(value);
-    return container;
+    return decodeTuple<sizeof...(T)>(container, value);
 }
 
 
 //-----------------------------------------------------------------------------
 
+#if __cplusplus >= 201703L
+
 template <typename T>
-inline tDecoderFn RString(T& value)
+inline Encoder& operator << (Encoder& container, const std::optional<T>& value)
 {
-    TString<T> target(value);
-    return std::bind(readValue< TString<T> >, 
-            std::placeholders::_1, std::ref(target));
+    if (!value)
+        return container.encodeNull();
+    
+    return container << *value;
 }
 
 
 //-----------------------------------------------------------------------------
 
 template <typename T>
-inline tDecoderFn RBytes(T& value)
+inline Decoder& operator >> (Decoder& container, std::optional<T>& value)
 {
-    TBytes<T> target(value);
-    return std::bind(readValue< TBytes<T> >, 
-            std::placeholders::_1, std::ref(target));
+    if (container.isNull() || container.isUndefined()) {
+        value.reset();
+        container.next();
+        return container;
+    }
+    
+    return container >> value.emplace();
 }
 
 
 //-----------------------------------------------------------------------------
 
-template <typename T>
-inline tDecoderFn RUint(T& value)
+#endif
+
+
+//-----------------------------------------------------------------------------
+// CBOR Token Cursor
+//-----------------------------------------------------------------------------
+
+enum TokenType
 {
-    TUint<T> target(value);
-    return std::bind(readValue< TUint<T> >, 
-            std::placeholders::_1, std::ref(target));
-}
+    TokenUint,
+    TokenNegInt,
+    TokenBytes,
+    TokenString,
+    TokenArray,
+    TokenMap,
+    TokenTag,
+    TokenSimple,
+    TokenBool,
+    TokenNull,
+    TokenUndefined,
+    TokenFloat,
+    TokenEnd
+};
 
 
 //-----------------------------------------------------------------------------
 
-template <typename T>
-inline tDecoderFn RInt(T& value)
+struct Token
 {
-    TInt<T> target(value);
-    return std::bind(readValue< TInt<T> >, 
-            std::placeholders::_1, std::ref(target));
-}
+    TokenType type;
+    size_t depth;
+    
+    /* integer magnitude (negative integers are -1 - value), tag number,
+     * simple value or boolean */
+    uint64_t value;
+    
+    /* half, single and double precision floats */
+    double real;
+    
+    /* view into the input for definite length strings, nullptr if chunked */
+    const uint8_t* data;
+    
+    /* string length or container item count, CborIndefiniteLength if unknown */
+    size_t length;
+    
+    /* iterator at the item, e.g. for Decoder(token.item).decodeString() */
+    CborValue item;
+    
+    int64_t asInt() const 
+    { 
+        return type == TokenNegInt ? -1 - (int64_t)value : (int64_t)value; 
+    }
+};
 
 
 //-----------------------------------------------------------------------------
 
-template <typename T>
-inline tDecoderFn RBool(T& value)
+/**
+ * Pull parser yielding one Token per item, containers are followed by their
+ * children at depth + 1 and a TokenEnd at the depth of the container.
+ * Items read through the cursor are consumed from the underlying Decoder.
+ */
+class DecoderCursor
 {
-    TBool<T> target(value);
-    return std::bind(readValue< TBool<T> >, 
-            std::placeholders::_1, std::ref(target));
-}
+
+public:
+    
+    DecoderCursor(Decoder& container, size_t depth_hint = 16) 
+        : m_rOuter(container.getIterator()), m_enterPending(false)
+    {
+        m_levels.reserve(depth_hint);
+    }
+    
+    bool next(Token& token)
+    {
+        CborError err;
+        
+        if (m_enterPending) {
+            CborValue inner;
+            err = cbor_value_enter_container(&current(), &inner);
+            if (err != CborNoError)
+                throw DecoderException(err);
+            m_levels.push_back(inner);
+            m_enterPending = false;
+        }
+        
+        CborValue& it = current();
+        
+        if (cbor_value_at_end(&it)) {
+            if (m_levels.empty())
+                return false;
+            
+            CborValue inner = m_levels.back();
+            m_levels.pop_back();
+            err = cbor_value_leave_container(&current(), &inner);
+            if (err != CborNoError)
+                throw DecoderException(err);
+            
+            token.type = TokenEnd;
+            token.depth = m_levels.size();
+            token.data = nullptr;
+            token.length = 0;
+            token.value = 0;
+            return true;
+        }
+        
+        const uint8_t* p = cbor_value_get_next_byte(&it);
+        uint8_t info = p[0] & 0x1f;
+        uint64_t arg = readArgument(p);
+        
+        token.depth = m_levels.size();
+        token.item = it;
+        token.value = arg;
+        token.data = nullptr;
+        token.length = 0;
+        
+        switch (p[0] >> 5) {
+        case 0:
+            token.type = TokenUint;
+            break;
+        case 1:
+            token.type = TokenNegInt;
+            break;
+        case 2:
+        case 3:
+            token.type = (p[0] >> 5) == 2 ? TokenBytes : TokenString;
+            token.value = 0;
+            if (info == 31) {
+                token.length = CborIndefiniteLength;
+            } else {
+                token.data = p + 1 + argumentSize(info);
+                token.length = arg;
+            }
+            err = cbor_value_advance(&it);
+            if (err != CborNoError)
+                throw DecoderException(err);
+            return true;
+        case 4:
+        case 5:
+            token.type = (p[0] >> 5) == 4 ? TokenArray : TokenMap;
+            token.value = 0;
+            token.length = info == 31 ? CborIndefiniteLength : arg;
+            m_enterPending = true;
+            return true;
+        case 6:
+            token.type = TokenTag;
+            break;
+        default:
+            switch (info) {
+            case 20:
+            case 21:
+                token.type = TokenBool;
+                token.value = info == 21;
+                break;
+            case 22:
+                token.type = TokenNull;
+                break;
+            case 23:
+                token.type = TokenUndefined;
+                break;
+            case 25:
+                token.type = TokenFloat;
+                token.real = halfToFloat((uint16_t)arg);
+                break;
+            case 26: {
+                uint32_t bits = (uint32_t)arg;
+                float f;
+                memcpy(&f, &bits, sizeof(f));
+                token.type = TokenFloat;
+                token.real = f;
+                break;
+            }
+            case 27:
+                token.type = TokenFloat;
+                memcpy(&token.real, &arg, sizeof(token.real));
+                break;
+            default:
+                token.type = TokenSimple;
+                break;
+            }
+            break;
+        }
+        
+        err = cbor_value_advance_fixed(&it);
+        if (err != CborNoError)
+            throw DecoderException(err);
+        
+        return true;
+    }
+    
+    /**
+     * Directly after a container token: skip the whole container, no TokenEnd 
+     * is reported for it. Otherwise: skip the remaining items of the current 
+     * container, the next token is its TokenEnd.
+     */
+    void skipChildren()
+    {
+        CborError err;
+        CborValue& it = current();
+        
+        if (m_enterPending) {
+            m_enterPending = false;
+            err = cbor_value_advance(&it);
+            if (err != CborNoError)
+                throw DecoderException(err);
+            return;
+        }
+        
+        while (!cbor_value_at_end(&it)) {
+            err = cbor_value_advance(&it);
+            if (err != CborNoError)
+                throw DecoderException(err);
+        }
+    }
+    
+    size_t depth() { return m_levels.size(); }
+    
+private:
+    
+    CborValue& current() 
+    { 
+        return m_levels.empty() ? m_rOuter : m_levels.back(); 
+    }
+    
+    static size_t argumentSize(uint8_t info)
+    {
+        return (info < 24 || info > 27) ? 0 : (size_t)1 << (info - 24);
+    }
+    
+    /* the parser has already checked that the header is within the buffer */
+    static uint64_t readArgument(const uint8_t* p)
+    {
+        uint8_t info = p[0] & 0x1f;
+        uint64_t value = 0;
+        
+        if (info < 24)
+            return info;
+        if (info > 27)
+            return 0;
+        
+        for (size_t i = 1; i <= argumentSize(info); ++i)
+            value = (value << 8) | p[i];
+        
+        return value;
+    }
+    
+    CborValue& m_rOuter;
+    std::vector<CborValue> m_levels;
+    bool m_enterPending;
+};
 
 
 //-----------------------------------------------------------------------------
 
-template <typename T>
-inline tDecoderFn RFloat(T& value)
+/**
+ * Enter a container tagged as stringref namespace. The strings it contains 
+ * are collected into refs in a single pass up front, so references can be 
+ * resolved in any order. Strings of nested namespaces are not collected.
+ */
+inline Decoder& enterStringRefNamespace(Decoder& container, StringRefTable& refs)
 {
-    TFloat<T> target(value);
-    return std::bind(readValue< TFloat<T> >, 
-            std::placeholders::_1, std::ref(target));
+    CborError err;
+    CborTag tag;
+    
+    if (!container.isTag())
+        throw DecoderException(CborErrorIllegalType);
+    err = cbor_value_get_tag(&container.getIterator(), &tag);
+    if (err != CborNoError)
+        throw DecoderException(err);
+    if (tag != TagStringRefNamespace)
+        throw DecoderException(CborErrorInappropriateTagForType);
+    container.next();
+    
+    refs.clear();
+    
+    CborValue position = container.getIterator();
+    Decoder scan(position);
+    DecoderCursor cursor(scan);
+    Token token;
+    
+    while (cursor.next(token) && !(token.type == TokenEnd && token.depth == 0)) {
+        if (token.type == TokenTag && token.value == TagStringRefNamespace) {
+            if (cursor.next(token) && (token.type == TokenArray || token.type == TokenMap))
+                cursor.skipChildren();
+            continue;
+        }
+        
+        if (token.type != TokenString && token.type != TokenBytes)
+            continue;
+        
+        if (token.data) {
+            refs.add(token.data, token.length, token.type == TokenString);
+            continue;
+        }
+        
+        /* chunked strings are joined into the table */
+        size_t len;
+        err = cbor_value_calculate_string_length(&token.item, &len);
+        if (err != CborNoError)
+            throw DecoderException(err);
+        
+        uint8_t* pData = refs.allocate(++len);
+        if (token.type == TokenString)
+            err = cbor_value_copy_text_string(
+                    &token.item, reinterpret_cast<char*>(pData), &len, nullptr);
+        else
+            err = cbor_value_copy_byte_string(&token.item, pData, &len, nullptr);
+        if (err != CborNoError)
+            throw DecoderException(err);
+        
+        refs.add(pData, len, token.type == TokenString);
+    }
+    
+    Decoder& inner = enter(container);
+    inner.setStringRefs(&refs);
+    return inner;
 }
 
 
 //-----------------------------------------------------------------------------
 
-template <typename T>
-inline tDecoderFn RDouble(T& value)
+inline tDecoderFn enterStringRefs(StringRefTable& refs)
 {
-    TDouble<T> target(value);
-    return std::bind(readValue< TFloat<T> >, 
-            std::placeholders::_1, std::ref(target));
+    return std::bind(enterStringRefNamespace, std::placeholders::_1, std::ref(refs));
 }
 
 
+//-----------------------------------------------------------------------------
+// Document Editing
+//-----------------------------------------------------------------------------
+
+/* step of a DocumentEditor path, a map key or an array index */
+struct PathStep
+{
+    PathStep(const char* name) : key(name), index(0) { }
+    PathStep(size_t position) : key(nullptr), index(position) { }
+    PathStep(int position) : key(nullptr), index((size_t)position) { }
+    
+    const char* key;
+    size_t index;
+};
+
+
+//-----------------------------------------------------------------------------
+
+/**
+ * Changes single items of an encoded document, e.g. before forwarding it. 
+ * The path is located with the decoder, the rest of the document is 
+ * neither decoded nor encoded again. A replacement of the same size 
+ * overwrites the item, otherwise the following bytes move with one memmove. 
+ * Container heads count items, not bytes, so they don't change.
+ * Paths into a stringref namespace are rejected, as a replaced string 
+ * would renumber the references behind it.
+ * 
+ *   DocumentEditor doc(buffer, size, sizeof(buffer));
+ *   doc.replace({"route", "hops"}, CUint(hops + 1));
+ *   send(buffer, doc.size());
+ */
+class DocumentEditor
+{
+
+public:
+    
+    struct Item
+    {
+        uint8_t* data;
+        size_t size;
+    };
+    
+    DocumentEditor(uint8_t* pBuffer, size_t size, size_t capacity)
+        : m_pBuffer(pBuffer), m_size(size), m_capacity(capacity) { }
+    
+    /* the encoded item at path including its tags, data is nullptr if 
+     * the path doesn't exist, throws CborErrorUnsupportedType if it enters 
+     * a stringref namespace */
+    Item find(std::initializer_list<PathStep> path)
+    {
+        CborParser parser;
+        CborValue it;
+        CborError err = cbor_parser_init(m_pBuffer, m_size, 0, &parser, &it);
+        if (err != CborNoError)
+            throw DecoderException(err);
+        
+        Item item = { nullptr, 0 };
+        for (const PathStep& step : path) {
+            if (!locate(it, step))
+                return item;
+        }
+        
+        const uint8_t* pBegin = cbor_value_get_next_byte(&it);
+        skip(it);
+        
+        item.data = m_pBuffer + (pBegin - m_pBuffer);
+        item.size = cbor_value_get_next_byte(&it) - pBegin;
+        return item;
+    }
+    
+    /* replace the item at path with one encoded item, false if it doesn't 
+     * exist, throws CborErrorImproperValue if value isn't a single item */
+    bool replace(std::initializer_list<PathStep> path, const CEncoded& value)
+    {
+        if (value.items != 1)
+            throw EncoderException(CborErrorImproperValue);
+        
+        Item item = find(path);
+        if (!item.data)
+            return false;
+        
+        if (value.size != item.size) {
+            if (m_size - item.size > m_capacity - value.size || value.size > m_capacity)
+                throw EncoderException(CborErrorOutOfMemory);
+            
+            uint8_t* pTail = item.data + item.size;
+            memmove(item.data + value.size, pTail, m_pBuffer + m_size - pTail);
+            m_size = m_size - item.size + value.size;
+        }
+        
+        memcpy(item.data, value.data, value.size);
+        return true;
+    }
+    
+    /* replace the item at path with value encoded as by an Encoder */
+    template <typename T>
+    bool replace(std::initializer_list<PathStep> path, const T& value)
+    {
+        InlineEncoderBuffer<64> encoder;
+        encoder << value;
+        
+        CEncoded encoded = { encoder.getBuffer(), encoder.size(), 1 };
+        return replace(path, encoded);
+    }
+    
+    size_t size() { return m_size; }
+    
+    uint8_t* getBuffer() { return m_pBuffer; }
+    
+private:
+    
+    /* move it from a container to its item at step */
+    static bool locate(CborValue& it, const PathStep& step)
+    {
+        CborError err;
+        
+        while (cbor_value_is_tag(&it)) {
+            CborTag tag;
+            if ((err = cbor_value_get_tag(&it, &tag)) != CborNoError)
+                throw DecoderException(err);
+            if (tag == TagStringRefNamespace)
+                throw DecoderException(CborErrorUnsupportedType);
+            if ((err = cbor_value_skip_tag(&it)) != CborNoError)
+                throw DecoderException(err);
+        }
+        if (step.key ? !cbor_value_is_map(&it) : !cbor_value_is_array(&it))
+            return false;
+        
+        CborValue child;
+        if ((err = cbor_value_enter_container(&it, &child)) != CborNoError)
+            throw DecoderException(err);
+        
+        if (step.key) {
+            while (!cbor_value_at_end(&child) && !matchKey(child, step.key))
+                skip(child);
+        } else {
+            for (size_t i = 0; i < step.index && !cbor_value_at_end(&child); ++i)
+                skip(child);
+        }
+        
+        if (cbor_value_at_end(&child))
+            return false;
+        
+        it = child;
+        return true;
+    }
+    
+    /* move it past the item and the tags in front of it, tinycbor 
+     * advances over a tag on its own */
+    static void skip(CborValue& it)
+    {
+        CborError err = cbor_value_skip_tag(&it);
+        if (err == CborNoError)
+            err = cbor_value_advance(&it);
+        if (err != CborNoError)
+            throw DecoderException(err);
+    }
+    
+    /* consumes the key */
+    static bool matchKey(CborValue& it, const char* key)
+    {
+        Decoder items(it);
+        
+        if (!items.isString()) {
+            skip(it);
+            return false;
+        }
+        if (!items.isLengthKnown())
+            return items.decodeString() == key;
+        
+        size_t len;
+        const uint8_t* p = items.decodeStringView(len);
+        return len == strlen(key) && memcmp(p, key, len) == 0;
+    }
+    
+    uint8_t* m_pBuffer;
+    size_t m_size;
+    size_t m_capacity;
+};
+
+
 //-----------------------------------------------------------------------------
 
 